@@ -2,7 +2,10 @@
 
 #include <cstddef>
 #include <memory>
+#include <typeinfo>
 #include <utility>
+#include "urcu-default.hpp"
+#include "rcu_trace.hpp"
 
 // Derived-type approach.  All RCU-protected data structures using this
 // approach must derive from std::rcu_obj_base, which in turn derives
@@ -13,24 +16,32 @@ namespace std {
     class rcu_obj_base: private rcu_head {
         D deleter;
     public:
+        // Lets rcu_domain_hp match protected objects against retired ones
+        friend rcu_head *rcu_head_of(rcu_obj_base *p) noexcept { return p; }
+
         static void trampoline(rcu_head *rhp)
         {
             auto rhdp = static_cast<rcu_obj_base *>(rhp);
             auto obj = static_cast<T *>(rhdp);
+            RCU_PROBE2(callback, obj, typeid(D).name());
             rhdp->deleter(obj);
         }
 
-        void retire(D d = {})
+        // bytes is counted against the domain's set_reclaim_budget()
+        void retire(D d = {}, size_t bytes = sizeof(T))
         {
             deleter = std::move(d);
-            ::call_rcu(static_cast<rcu_head *>(this), trampoline);
+            rcu_global_domain rd;
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rd.retire(static_cast<rcu_head *>(this), trampoline, bytes);
         }
 
         template<class RcuDomain>
-        void retire(RcuDomain& rd, D d = {})
+        void retire(RcuDomain& rd, D d = {}, size_t bytes = sizeof(T))
         {
             deleter = std::move(d);
-            rd.retire(static_cast<rcu_head *>(this), trampoline);
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rcu::detail::retire_sized(rd, static_cast<rcu_head *>(this), trampoline, bytes, 0);
         }
     };
 
@@ -40,22 +51,29 @@ namespace std {
     template<typename T, typename D>
     class rcu_obj_base<T,D,true>: private rcu_head {
     public:
+        // As above
+        friend rcu_head *rcu_head_of(rcu_obj_base *p) noexcept { return p; }
+
         static void trampoline(rcu_head *rhp)
         {
             auto rhdp = static_cast<rcu_obj_base *>(rhp);
             auto obj = static_cast<T *>(rhdp);
+            RCU_PROBE2(callback, obj, typeid(D).name());
             D()(obj);
         }
 
-        void retire(D = {})
+        void retire(D = {}, size_t bytes = sizeof(T))
         {
-            ::call_rcu(static_cast<rcu_head *>(this), trampoline);
+            rcu_global_domain rd;
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rd.retire(static_cast<rcu_head *>(this), trampoline, bytes);
         }
 
         template<class RcuDomain>
-        void retire(RcuDomain& rd, D = {})
+        void retire(RcuDomain& rd, D = {}, size_t bytes = sizeof(T))
         {
-            rd.retire(static_cast<rcu_head *>(this), trampoline);
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rcu::detail::retire_sized(rd, static_cast<rcu_head *>(this), trampoline, bytes, 0);
         }
     };
 } // namespace std
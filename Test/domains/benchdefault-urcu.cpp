@@ -0,0 +1,44 @@
+#include <urcu/urcu-memb.h>
+#include <urcu/urcu-mb.h>
+#include <urcu/urcu-signal.h>
+#include <urcu/urcu-qsbr.h>
+#include <urcu/urcu-bp.h>
+#include "benchread.hpp"
+
+// The liburcu side of benchdefault: every flavor through its own prefixed
+// API (liburcu 0.11 and later), so one file can use them all.  Kept apart
+// from benchdefault.cpp, which defines its own struct rcu_head.
+
+extern const char *const urcu_flavor_names[] = { "urcu_memb", "urcu_mb", "urcu_signal", "urcu_qsbr", "urcu_bp" };
+extern const int num_urcu_flavors = sizeof(urcu_flavor_names) / sizeof(urcu_flavor_names[0]);
+
+double urcu_read_section_ns(const int flavor, const int nthreads)
+{
+	switch (flavor) {
+	case 0:
+		return read_section_ns(nthreads, []{ urcu_memb_register_thread(); },
+				       []{ urcu_memb_read_lock(); return 0; },
+				       [](int){ urcu_memb_read_unlock(); },
+				       []{ urcu_memb_unregister_thread(); });
+	case 1:
+		return read_section_ns(nthreads, []{ urcu_mb_register_thread(); },
+				       []{ urcu_mb_read_lock(); return 0; },
+				       [](int){ urcu_mb_read_unlock(); },
+				       []{ urcu_mb_unregister_thread(); });
+	case 2:
+		return read_section_ns(nthreads, []{ urcu_signal_register_thread(); },
+				       []{ urcu_signal_read_lock(); return 0; },
+				       [](int){ urcu_signal_read_unlock(); },
+				       []{ urcu_signal_unregister_thread(); });
+	case 3:
+		return read_section_ns(nthreads, []{ urcu_qsbr_register_thread(); },
+				       []{ urcu_qsbr_read_lock(); return 0; },
+				       [](int){ urcu_qsbr_read_unlock(); },
+				       []{ urcu_qsbr_unregister_thread(); });
+	default:
+		return read_section_ns(nthreads, []{},
+				       []{ urcu_bp_read_lock(); return 0; },
+				       [](int){ urcu_bp_read_unlock(); },
+				       []{});
+	}
+}
@@ -0,0 +1,42 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#define RCU_HEADER_ONLY 1
+#include "rcu.hpp"
+#include "benchread.hpp"
+
+// Read-side cost of the header-only default domain, whose primitives the
+// compiler inlines, next to the liburcu flavors, whose read side is a call
+// into the library (see benchdefault-urcu.cpp).  Nanoseconds per critical
+// section of a single load, without updaters.  Build with optimization (see
+// Makefile).
+
+extern const char *const urcu_flavor_names[];
+extern const int num_urcu_flavors;
+double urcu_read_section_ns(int flavor, int nthreads);
+
+int main()
+{
+	std::rcu_global_domain gd;
+
+	std::cout << "ns per read-side critical section ("
+		  << (std::rcu_global_domain::domain().effective_read_side() ==
+		      rcu_domain_rv::read_side::membarrier ? "membarrier" : "fenced")
+		  << " read side for the default domain)\n";
+	std::cout << std::setw(12) << "threads" << std::setw(12) << "default";
+	for (int f = 0; f < num_urcu_flavors; f++)
+		std::cout << std::setw(12) << urcu_flavor_names[f];
+	std::cout << "\n";
+	for (int n = 1; n <= (int)std::thread::hardware_concurrency(); n *= 2) {
+		std::cout << std::setw(12) << n << std::fixed << std::setprecision(2);
+		std::cout << std::setw(12)
+			  << read_section_ns(n, []{},
+					     [&gd]{ gd.read_lock(); return 0; },
+					     [&gd](int){ gd.read_unlock(); },
+					     []{});
+		for (int f = 0; f < num_urcu_flavors; f++)
+			std::cout << std::setw(12) << urcu_read_section_ns(f, n);
+		std::cout << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <urcu.h>
+#include "rcu_domain.hpp"
+
+// Read-mostly throughput of rcu_domain_ebr against the liburcu flavors and
+// the other pure-C++ domains, all driven through rcu_domain_base so that
+// every domain pays the same dispatch cost.  Each thread reads a shared
+// node, and one operation in update_every replaces it and retires the old
+// one.  Build with optimization (see Makefile).
+
+struct node {
+	long value;
+	rcu_head rh;
+};
+
+void free_node(rcu_head *rhp)
+{
+	delete reinterpret_cast<node *>(reinterpret_cast<char *>(rhp) - offsetof(node, rh));
+}
+
+extern std::rcu::rcu_domain_base& rb;
+extern std::rcu::rcu_domain_base& rm;
+extern std::rcu::rcu_domain_base& rq;
+extern std::rcu::rcu_domain_base& rs;
+extern std::rcu::rcu_domain_base& rv;
+extern std::rcu::rcu_domain_base& rc;
+extern std::rcu::rcu_domain_base& re;
+
+// Millions of operations per second over all threads
+double throughput(std::rcu::rcu_domain_base& d, int nthreads, int update_every)
+{
+	const std::chrono::milliseconds duration(500);
+	std::atomic<node *> shared(new node{ 0, {} });
+	std::atomic<bool> stop(false);
+	std::atomic<long> total(0);
+	std::atomic<long> sink(0);	// Keeps the reads from being optimized out
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < nthreads; t++) {
+		threads.emplace_back([&, t]() {
+			long ops = 0;
+			long sum = 0;
+
+			d.register_thread();
+			while (!stop.load(std::memory_order_relaxed)) {
+				if (ops % update_every == update_every - 1) {
+					node *old = shared.exchange(new node{ ops, {} });
+					d.retire(&old->rh, free_node);
+				} else {
+					d.read_lock();
+					sum += shared.load(std::memory_order_acquire)->value;
+					d.read_unlock();
+				}
+				if (d.quiescent_state_needed())
+					d.quiescent_state();
+				ops++;
+			}
+			d.unregister_thread();
+			total += ops;
+			sink += sum;
+		});
+	}
+	std::this_thread::sleep_for(duration);
+	stop = true;
+	for (auto& t : threads)
+		t.join();
+	d.barrier();
+	delete shared.load();
+	return total / (duration.count() * 1000.0);
+}
+
+int main()
+{
+	struct { std::rcu::rcu_domain_base *d; const char *name; } domains[] = {
+		{ &rb, "rcu_bp" }, { &rm, "rcu_mb" }, { &rq, "rcu_qsbr" },
+		{ &rs, "rcu_signal" }, { &rv, "rcu_rv" }, { &rc, "rcu_srcu" },
+		{ &re, "rcu_ebr" },
+	};
+	const int update_every[] = { 1000, 10 };
+
+	for (int ue : update_every) {
+		std::cout << "Mops/s, one update in " << ue << " operations\n";
+		std::cout << std::setw(12) << "threads";
+		for (auto& dom : domains)
+			std::cout << std::setw(12) << dom.name;
+		std::cout << "\n";
+		for (int n = 1; n <= (int)std::thread::hardware_concurrency(); n *= 2) {
+			std::cout << std::setw(12) << n;
+			for (auto& dom : domains)
+				std::cout << std::setw(12) << std::setprecision(3)
+					  << throughput(*dom.d, n, ue);
+			std::cout << "\n";
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "urcu-mb.hpp"
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "rcu_executor.hpp"
+
+// Free throughput by callback placement: updater threads allocate objects
+// and retire them at once for MILLISECONDS, then wait for their callbacks;
+// millions of objects freed per second, counting that wait.  Callbacks run
+// on the domain's own thread, on the retiring thread (thread_return_executor,
+// drained every DRAIN_EVERY retires) or, for liburcu, on per-CPU call_rcu
+// workers.  Per-CPU workers cannot be turned off again, so they come last.
+// Build with optimization (see Makefile).
+
+const int MILLISECONDS = 500;
+const int DRAIN_EVERY = 64;
+const size_t OBJECT_SIZE = 256;
+
+struct object {
+	rcu_head rh;
+	char payload[OBJECT_SIZE - sizeof(rcu_head)];
+};
+
+void free_object(rcu_head *rhp)
+{
+	delete reinterpret_cast<object *>(rhp);
+}
+
+template<class Domain>
+void bench(Domain& d, const char *name, const char *placement, int nthreads,
+	   std::rcu::thread_return_executor *ex)
+{
+	std::atomic<bool> stop(false);
+	std::atomic<long> total(0);
+	std::vector<std::thread> threads;
+
+	d.set_callback_executor(ex);
+	const auto start = std::chrono::steady_clock::now();
+	for (int t = 0; t < nthreads; t++) {
+		threads.emplace_back([&]() {
+			long n = 0;
+
+			d.register_thread();
+			while (!stop.load(std::memory_order_relaxed)) {
+				object *p = new object;
+				p->payload[0] = (char)n;
+				d.retire(&p->rh, free_object);
+				if (++n % DRAIN_EVERY == 0 && ex != nullptr)
+					ex->run_pending();
+			}
+			d.barrier();
+			if (ex != nullptr)
+				ex->run_pending();
+			d.unregister_thread();
+			total += n;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(MILLISECONDS));
+	stop = true;
+	for (auto& t : threads)
+		t.join();
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	d.set_callback_executor(nullptr);
+	std::cout << std::setw(12) << name << std::setw(16) << placement << std::fixed
+		  << std::setprecision(2) << std::setw(12) << total.load() / seconds / 1e6 << "\n";
+}
+
+int main()
+{
+	rcu_domain_mb m;
+	rcu_domain_rv v;
+	rcu_domain_srcu c;
+	std::rcu::thread_return_executor ex;
+	const int nthreads = std::max(2, (int)std::thread::hardware_concurrency());
+
+	std::cout << "Mobjects/s freed, " << nthreads << " updater threads\n";
+	bench(v, "rcu_rv", "reclaimer", nthreads, nullptr);
+	bench(v, "rcu_rv", "retiring thread", nthreads, &ex);
+	bench(c, "rcu_srcu", "callback thread", nthreads, nullptr);
+	bench(c, "rcu_srcu", "retiring thread", nthreads, &ex);
+	bench(m, "rcu_mb", "call_rcu worker", nthreads, nullptr);
+	bench(m, "rcu_mb", "retiring thread", nthreads, &ex);
+	if (rcu_domain_mb::use_per_cpu_call_rcu_data())
+		bench(m, "rcu_mb", "per-CPU workers", nthreads, nullptr);
+	else
+		std::cout << "(no per-CPU call_rcu workers here)\n";
+	return 0;
+}
@@ -0,0 +1,9 @@
+#include "urcu-mb.hpp"
+#include "benchpool.hpp"
+
+// The rcu_domain_mb half of benchpool.cpp
+pool_result pool_throughput_mb(const int nthreads)
+{
+	rcu_domain_mb d;
+	return pool_throughput(d, nthreads);
+}
@@ -0,0 +1,9 @@
+#include "urcu-signal.hpp"
+#include "benchpool.hpp"
+
+// The rcu_domain_signal half of benchpool.cpp
+pool_result pool_throughput_signal(const int nthreads)
+{
+	rcu_domain_signal d;
+	return pool_throughput(d, nthreads);
+}
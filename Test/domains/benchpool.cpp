@@ -0,0 +1,34 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <algorithm>
+#include "urcu-qsbr.hpp"
+#include "benchpool.hpp"
+
+// rcu::thread_pool throughput over rcu_domain_qsbr, whose tasks read at no
+// cost while the pool reports quiescent states for them, next to the same
+// pool over rcu_domain_mb and rcu_domain_signal (benchpool-mb.cpp and
+// benchpool-signal.cpp, one flavor per file as liburcu requires), with an
+// updater waiting for grace periods throughout.  Millions of tasks per
+// second and the updates completed.  Build with optimization (see Makefile).
+
+pool_result pool_throughput_mb(int nthreads);
+pool_result pool_throughput_signal(int nthreads);
+
+int main()
+{
+	rcu_domain_qsbr q;
+	const int maxThreads = std::max(2, (int)std::thread::hardware_concurrency());
+
+	std::cout << std::setw(8) << "workers" << std::setw(29) << "qsbr" << std::setw(29) << "mb"
+		  << std::setw(29) << "signal" << "\n";
+	for (int n = 1; n <= maxThreads; n *= 2) {
+		const pool_result r[] = { pool_throughput(q, n), pool_throughput_mb(n), pool_throughput_signal(n) };
+		std::cout << std::setw(8) << n << std::fixed << std::setprecision(2);
+		for (const pool_result& x : r)
+			std::cout << std::setw(10) << x.tasks_per_second / 1e6 << " Mtasks/s" << std::setw(6) << x.updates
+				  << " upd";
+		std::cout << "\n";
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include "rcu_thread_pool.hpp"
+
+// Tasks per second through an rcu::thread_pool of nthreads workers over
+// Domain, for benchpool.cpp.  Each task looks up a shared RCU-protected
+// object LOOKUPS times, each in its own read-side critical section, while
+// an updater replaces the object every UPDATE_US microseconds and frees the
+// old one after synchronize().  A header so that each flavor's file inlines
+// its own read side into the tasks.
+
+struct pool_object {
+	long value;
+};
+
+struct pool_result {
+	double tasks_per_second;
+	long updates;
+};
+
+template<class Domain>
+pool_result pool_throughput(Domain& d, const int nthreads)
+{
+	const int LOOKUPS = 100;
+	const long UPDATE_US = 100;
+	const int BATCH = 10000;		// Tasks in flight
+	const std::chrono::milliseconds duration(500);
+	std::atomic<pool_object *> shared(new pool_object{1});
+	std::atomic<bool> stop(false);
+	std::atomic<long> sink(0);
+	long updates = 0;
+	long tasks = 0;
+
+	std::thread updater([&]() {
+		while (!stop.load(std::memory_order_relaxed)) {
+			pool_object *old = shared.exchange(new pool_object{updates});
+			d.synchronize();
+			delete old;
+			updates++;
+			std::this_thread::sleep_for(std::chrono::microseconds(UPDATE_US));
+		}
+	});
+	const auto start = std::chrono::steady_clock::now();
+	{
+		std::rcu::thread_pool<Domain> pool(d, nthreads);
+		while (std::chrono::steady_clock::now() - start < duration) {
+			for (int i = 0; i < BATCH; i++) {
+				pool.submit([&]() {
+					long sum = 0;
+					for (int j = 0; j < LOOKUPS; j++) {
+						d.read_lock();
+						sum += shared.load(std::memory_order_acquire)->value;
+						d.read_unlock();
+					}
+					sink.fetch_add(sum, std::memory_order_relaxed);
+				});
+			}
+			pool.wait_idle();
+			tasks += BATCH;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	stop = true;
+	updater.join();
+	delete shared.load();
+	return pool_result{ tasks / seconds, updates };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+
+// Nanoseconds per read-side critical section (lock, one load, unlock) with
+// nthreads readers and no updater.  A header so that benchdefault.cpp and
+// benchdefault-urcu.cpp each inline their own primitives into the loop;
+// enter and leave run once per thread, around it.
+template<class Enter, class Lock, class Unlock, class Leave>
+double read_section_ns(const int nthreads, Enter enter, Lock lock, Unlock unlock, Leave leave)
+{
+	const std::chrono::milliseconds duration(300);
+	std::atomic<long> shared(1);
+	std::atomic<bool> stop(false);
+	std::atomic<long> total(0);
+	std::atomic<long> sink(0);	// Keeps the reads from being optimized out
+	std::vector<std::thread> threads;
+
+	for (int t = 0; t < nthreads; t++) {
+		threads.emplace_back([&]() {
+			long ops = 0;
+			long sum = 0;
+
+			enter();
+			while (!stop.load(std::memory_order_relaxed)) {
+				for (int i = 0; i < 1000; i++) {
+					auto tok = lock();
+					sum += shared.load(std::memory_order_relaxed);
+					unlock(tok);
+				}
+				ops += 1000;
+			}
+			leave();
+			total += ops;
+			sink += sum;
+		});
+	}
+	std::this_thread::sleep_for(duration);
+	stop = true;
+	for (auto& t : threads)
+		t.join();
+	return std::chrono::duration<double, std::nano>(duration).count() * nthreads / total;
+}
@@ -0,0 +1,177 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#include "urcu-rv.hpp"
+#include "rcu_guard.hpp"
+
+// Benchmarks for rcu_domain_rv.  Build with optimization (see Makefile).
+
+template<class F>
+double ns_per_op(long n, F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < n; i++)
+		f();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+// Pin the calling thread to one CPU, round-robin over the online CPUs.
+void pin_to_cpu(int i)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(i % std::thread::hardware_concurrency(), &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// Registered but idle reader threads, parked until destroyed, and
+// optionally pinned to CPUs before registering.
+class idle_readers {
+	std::mutex m;
+	std::condition_variable cv;
+	bool done = false;
+	int registered = 0;
+	std::vector<std::thread> threads;
+public:
+	idle_readers(rcu_domain_rv& d, int n, bool pinned = false)
+	{
+		for (int i = 0; i < n; i++) {
+			threads.emplace_back([this, &d, i, pinned]() {
+				if (pinned)
+					pin_to_cpu(i);
+				d.register_thread();
+				std::unique_lock<std::mutex> lock(m);
+				registered++;
+				cv.notify_all();
+				cv.wait(lock, [this]() { return done; });
+				lock.unlock();
+				d.unregister_thread();
+			});
+		}
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [this, n]() { return registered == n; });
+	}
+
+	~idle_readers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			done = true;
+			cv.notify_all();
+		}
+		for (auto& t : threads)
+			t.join();
+	}
+};
+
+// Grace-period latency against the number of registered readers, in a
+// domain whose slot capacity stays far above that number.
+void bench_grace_period_vs_readers()
+{
+	const int capacity = 4096;
+	rcu_domain_rv rv(capacity);
+
+	std::cout << "synchronize() latency, " << capacity << " reader slots\n";
+	std::cout << std::setw(10) << "readers" << std::setw(12) << "ns" << "\n";
+	for (int n = 0; n <= 256; n = n ? n * 4 : 1) {
+		idle_readers readers(rv, n);
+		double ns = ns_per_op(10000, [&rv]() { rv.synchronize(); });
+		std::cout << std::setw(10) << n << std::setw(12) << ns << "\n";
+	}
+}
+
+// Read-side and grace-period cost of the fenced and membarrier read sides.
+void bench_read_side_modes()
+{
+	typedef rcu_domain_rv::read_side read_side;
+	const read_side modes[] = { read_side::fenced, read_side::membarrier };
+
+	for (read_side mode : modes) {
+		rcu_domain_rv rv(32, 1, rcu_domain_rv::wait_policy::park, mode);
+		bool membarrier = rv.effective_read_side() == read_side::membarrier;
+		if (mode == read_side::membarrier && !membarrier) {
+			std::cout << "membarrier read side unavailable, skipped\n";
+			continue;
+		}
+		idle_readers readers(rv, 4);
+		rv.register_thread();
+		double rd = ns_per_op(10000000, [&rv]() {
+			rv.read_lock();
+			rv.read_unlock();
+		});
+		rv.unregister_thread();
+		double gp = ns_per_op(10000, [&rv]() { rv.synchronize(); });
+		std::cout << (membarrier ? "membarrier" : "fenced    ")
+			  << " read_lock()/read_unlock(): " << rd << " ns, "
+			  << "synchronize(): " << gp << " ns\n";
+	}
+}
+
+// Grace-period latency against the number of pinned reader threads, with
+// flat and per-NUMA-node (numa_tree) reader tracking.
+void bench_numa_tree()
+{
+	typedef rcu_domain_rv::reader_tracking reader_tracking;
+
+	rcu_domain_rv flat(32, 1, rcu_domain_rv::wait_policy::park,
+			   rcu_domain_rv::read_side::fenced, reader_tracking::flat);
+	rcu_domain_rv tree(32, 1, rcu_domain_rv::wait_policy::park,
+			   rcu_domain_rv::read_side::fenced, reader_tracking::numa_tree);
+
+	std::cout << "synchronize() latency, pinned readers, "
+		  << std::thread::hardware_concurrency() << " CPUs\n";
+	std::cout << std::setw(10) << "threads" << std::setw(12) << "flat ns"
+		  << std::setw(12) << "tree ns" << "\n";
+	for (int n = 1; n <= 256; n *= 4) {
+		double ns[2];
+		rcu_domain_rv *domains[] = { &flat, &tree };
+		for (int i = 0; i < 2; i++) {
+			rcu_domain_rv& d = *domains[i];
+			idle_readers readers(d, n, true);
+			ns[i] = ns_per_op(10000, [&d]() { d.synchronize(); });
+		}
+		std::cout << std::setw(10) << n << std::setw(12) << ns[0]
+			  << std::setw(12) << ns[1] << "\n";
+	}
+}
+
+// Read-side cost of an rcu_guard whose domain is known at compile time
+// against one going through rcu_domain_base and rcu_domain_wrapper.  Uses
+// the membarrier read side when available, whose cost is low enough for
+// the dispatch to show.
+void bench_static_vs_virtual_dispatch()
+{
+	rcu_domain_rv rv(32, 1, rcu_domain_rv::wait_policy::park,
+			 rcu_domain_rv::read_side::membarrier);
+	std::rcu::rcu_domain_wrapper<rcu_domain_rv> rvw(rv);
+	// Read back through a volatile so that the compiler cannot devirtualize
+	std::rcu::rcu_domain_base *volatile rbp = &rvw;
+	std::rcu::rcu_domain_base& rb = *rbp;
+	const long n = 10000000;
+
+	rv.register_thread();
+	double direct = ns_per_op(n, [&rv]() { rcu_guard<rcu_domain_rv> g(rv); });
+	double virt = ns_per_op(n, [&rb]() { rcu_guard<std::rcu::rcu_domain_base> g(rb); });
+	rv.unregister_thread();
+	std::cout << "rcu_guard<rcu_domain_rv>:  " << direct << " ns\n";
+	std::cout << "rcu_guard<rcu_domain_base>: " << virt << " ns\n";
+}
+
+int main()
+{
+	bench_grace_period_vs_readers();
+	bench_read_side_modes();
+	bench_numa_tree();
+	bench_static_vs_virtual_dispatch();
+	return 0;
+}
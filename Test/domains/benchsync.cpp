@@ -0,0 +1,112 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "rcu_domain.hpp"
+
+// Latency of synchronize() and synchronize_expedited() on every domain,
+// through rcu_domain_base, while reader threads keep entering read-side
+// critical sections of SECTION_US microseconds.  Updates are rare, so the
+// updater sleeps between calls.  Median and 99th percentile over ROUNDS
+// calls each, in microseconds.  The liburcu flavors have no expedited grace
+// period, so both columns time synchronize() there.  Build with
+// optimization (see Makefile).
+
+extern std::rcu::rcu_domain_base& rb;
+extern std::rcu::rcu_domain_base& rm;
+extern std::rcu::rcu_domain_base& rq;
+extern std::rcu::rcu_domain_base& rs;
+extern std::rcu::rcu_domain_base& rv;
+extern std::rcu::rcu_domain_base& rc;
+extern std::rcu::rcu_domain_base& re;
+extern std::rcu::rcu_domain_base& rh;
+extern std::rcu::rcu_domain_base& rr;
+
+const int ROUNDS = 200;
+const int SECTION_US[] = { 1, 50 };	// Read-side critical section lengths
+
+struct latency {
+	double median;
+	double p99;
+};
+
+latency summarize(std::vector<double>& us)
+{
+	std::sort(us.begin(), us.end());
+	return latency{ us[us.size() / 2], us[us.size() * 99 / 100] };
+}
+
+template<class F>
+double time_us(F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+void bench(std::rcu::rcu_domain_base& d, const char *name, int nreaders, int section_us)
+{
+	std::atomic<bool> stop(false);
+	std::atomic<long> sink(0);
+	std::atomic<int> started(0);
+	std::vector<std::thread> readers;
+
+	for (int t = 0; t < nreaders; t++) {
+		readers.emplace_back([&]() {
+			long sum = 0;
+
+			d.register_thread();
+			started++;
+			while (!stop.load(std::memory_order_relaxed)) {
+				const auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(section_us);
+				d.read_lock();
+				while (std::chrono::steady_clock::now() < until)
+					sum++;
+				d.read_unlock();
+				if (d.quiescent_state_needed())
+					d.quiescent_state();
+			}
+			d.unregister_thread();
+			sink += sum;
+		});
+	}
+	while (started.load() != nreaders)
+		std::this_thread::yield();
+	// Alternated, so that both see the same reader behaviour
+	std::vector<double> normal_us, expedited_us;
+	for (int i = 0; i < ROUNDS; i++) {
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		normal_us.push_back(time_us([&d]{ d.synchronize(); }));
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+		expedited_us.push_back(time_us([&d]{ d.synchronize_expedited(); }));
+	}
+	const latency normal = summarize(normal_us);
+	const latency expedited = summarize(expedited_us);
+	stop = true;
+	for (auto& t : readers)
+		t.join();
+	std::cout << std::setw(12) << name << std::fixed << std::setprecision(1)
+		  << std::setw(12) << normal.median << std::setw(12) << normal.p99
+		  << std::setw(12) << expedited.median << std::setw(12) << expedited.p99 << "\n";
+}
+
+int main()
+{
+	struct { std::rcu::rcu_domain_base *d; const char *name; } domains[] = {
+		{ &rb, "rcu_bp" }, { &rm, "rcu_mb" }, { &rq, "rcu_qsbr" },
+		{ &rs, "rcu_signal" }, { &rv, "rcu_rv" }, { &rc, "rcu_srcu" },
+		{ &re, "rcu_ebr" }, { &rh, "rcu_hp" }, { &rr, "rcu_rseq" },
+	};
+	const int nreaders = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	for (int section_us : SECTION_US) {
+		std::cout << "us, " << nreaders << " readers in " << section_us << " us sections:"
+			  << " synchronize() median, p99, then synchronize_expedited() median, p99\n";
+		for (auto& dom : domains)
+			bench(*dom.d, dom.name, nreaders, section_us);
+	}
+	return 0;
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <map>
+#include <type_traits>
+#include <utility>
+#if __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#endif
+#include "rcu_domain.hpp"
+
+// Grace periods and barriers for updaters that must not block, such as
+// those running on an event loop.  synchronize_async(d) and barrier_async(d)
+// return at once with an rcu::async_wait, which hands out a std::future and,
+// when built as C++20, can be co_awaited directly:
+//
+//	auto old = p.exchange(fresh);
+//	co_await std::rcu::synchronize_async(dom);
+//	delete old;
+//
+// Any domain works, including rcu_domain_base.  The awaiting coroutine is
+// resumed on the thread that completes the wait, normally the domain's
+// callback thread; a coroutine with heavy work to do after the grace period
+// should hand itself back to its own executor first, and must not call
+// barrier() there, just as a callback must not.
+//
+// synchronize_async() retires a small marker object through the domain's
+// retire(), and its callback completes the wait, so no thread is tied up.
+// That needs a domain that invokes callbacks on a thread of its own.  The
+// others say so with callbacks_need_retire() (rcu_domain_ebr,
+// rcu_domain_hp, which only invoke them from later retire() calls), and
+// rcu_domain_base cannot tell; for those the wait is a synchronize() on an
+// async worker, as below.
+//
+// A barrier cannot be built out of retire() that way: a domain with several
+// reclaimers or per-thread lists does not invoke callbacks in the order they
+// were retired.  barrier_async() instead queues the request for an async
+// worker, a thread per domain with requests outstanding, which runs
+// barrier() once for every request queued so far; waits are thus coalesced
+// rather than each costing a thread, and a slow domain delays only its own.
+
+namespace std {
+namespace rcu {
+    namespace detail {
+	struct async_state {
+	    mutex m;
+	    bool done = false;
+	    promise<void> p;
+#if __cpp_impl_coroutine >= 201902L
+	    coroutine_handle<> waiter;
+#endif
+
+	    void complete()
+	    {
+		unique_lock<mutex> lock(m);
+		done = true;
+		p.set_value();
+#if __cpp_impl_coroutine >= 201902L
+		coroutine_handle<> h = waiter;
+		lock.unlock();
+		if (h) h.resume();
+#endif
+	    }
+	};
+    } // namespace detail
+
+    // The pending result of synchronize_async() or barrier_async()
+    class async_wait {
+	shared_ptr<detail::async_state> state;
+    public:
+	explicit async_wait(shared_ptr<detail::async_state> s) noexcept : state(std::move(s)) {}
+
+	bool ready() const
+	{
+	    lock_guard<mutex> lock(state->m);
+	    return state->done;
+	}
+
+	// At most once
+	future<void> get_future() { return state->p.get_future(); }
+
+#if __cpp_impl_coroutine >= 201902L
+	bool await_ready() const { return ready(); }
+	bool await_suspend(coroutine_handle<> h)
+	{
+	    lock_guard<mutex> lock(state->m);
+	    if (state->done) return false;
+	    state->waiter = h;
+	    return true;
+	}
+	void await_resume() const noexcept {}
+#endif
+    };
+
+    namespace detail {
+	// Retired in place of an object.  Only liburcu writes to the rcu_head,
+	// which is two pointers there and in urcu-default.hpp; the pure-C++
+	// domains just pass the pointer back, so it need not be complete here.
+	struct async_marker {
+	    alignas(void *) unsigned char head[4 * sizeof(void *)];
+	    shared_ptr<async_state> state;
+
+	    static void invoke(rcu_head *rhp)
+	    {
+		async_marker *m = reinterpret_cast<async_marker *>(rhp);
+		m->state->complete();
+		delete m;
+	    }
+	};
+
+	// Runs blocking waits for async_wait, on one thread per domain that
+	// has requests queued.  The thread exits once its queue is empty.
+	class async_worker {
+	    struct request {
+		void (*wait)(void *domain);
+		shared_ptr<async_state> state;
+	    };
+
+	    mutex m;
+	    map<void *, vector<request>> queues;	// Each with its thread running
+
+	    void run(void *domain)
+	    {
+		vector<request> batch;
+		for (;;) {
+		    {
+			lock_guard<mutex> lock(m);
+			auto it = queues.find(domain);
+			if (it->second.empty()) {
+			    queues.erase(it);
+			    return;
+			}
+			batch.swap(it->second);
+		    }
+		    // One wait of each kind covers every request taken
+		    for (size_t i = 0; i < batch.size(); i++) {
+			bool seen = false;
+			for (size_t j = 0; j < i && !seen; j++) seen = batch[j].wait == batch[i].wait;
+			if (!seen) batch[i].wait(domain);
+		    }
+		    for (request& r : batch) r.state->complete();
+		    batch.clear();
+		}
+	    }
+
+	public:
+	    // Never destroyed, like the threads, so that requests may still be
+	    // pending while the program exits.
+	    static async_worker& instance()
+	    {
+		static async_worker *w = new async_worker;
+		return *w;
+	    }
+
+	    void submit(void *domain, void (*wait)(void *), shared_ptr<async_state> state)
+	    {
+		lock_guard<mutex> lock(m);
+		auto it = queues.find(domain);
+		if (it != queues.end()) {
+		    it->second.push_back(request{wait, std::move(state)});
+		    return;
+		}
+		queues[domain].push_back(request{wait, std::move(state)});
+		thread(&async_worker::run, this, domain).detach();
+	    }
+	};
+
+	// Whether retire() gets a marker invoked without further help
+	template<class Domain>
+	constexpr auto retire_completes(int) -> decltype(Domain::callbacks_need_retire(), bool())
+	{
+	    return !Domain::callbacks_need_retire();
+	}
+
+	template<class Domain>
+	constexpr bool retire_completes(long)
+	{
+	    return !is_base_of<rcu_domain_base, Domain>::value;
+	}
+
+	template<class Domain>
+	async_wait synchronize_async(Domain& d, true_type)
+	{
+	    async_marker *m = new async_marker;
+	    m->state = make_shared<async_state>();
+	    async_wait w(m->state);
+	    d.retire(reinterpret_cast<rcu_head *>(m), async_marker::invoke);
+	    return w;
+	}
+
+	template<class Domain>
+	async_wait synchronize_async(Domain& d, false_type)
+	{
+	    shared_ptr<async_state> s = make_shared<async_state>();
+	    async_wait w(s);
+	    async_worker::instance().submit(
+		&d, [](void *p) { static_cast<Domain *>(p)->synchronize(); }, std::move(s));
+	    return w;
+	}
+    } // namespace detail
+
+    template<class Domain>
+    async_wait synchronize_async(Domain& d)
+    {
+	return detail::synchronize_async(d, integral_constant<bool, detail::retire_completes<Domain>(0)>());
+    }
+
+    template<class Domain>
+    async_wait barrier_async(Domain& d)
+    {
+	shared_ptr<detail::async_state> s = make_shared<detail::async_state>();
+	async_wait w(s);
+	detail::async_worker::instance().submit(
+	    &d, [](void *p) { static_cast<Domain *>(p)->barrier(); }, std::move(s));
+	return w;
+    }
+} // namespace rcu
+} // namespace std
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __NR_membarrier
+#include <linux/membarrier.h>
+#endif
+#endif
+#include "rcu_domain.hpp"
+
+// The grace periods and callback thread shared by rcu_domain_srcu and
+// rcu_domain_rseq, which differ only in how read_lock() and read_unlock()
+// bump the per-CPU counters.  Each CPU id the kernel may hand out has a
+// lock and an unlock counter for each of two indexes, and an index has no
+// readers left when the sum of its unlock counters, read first, equals the
+// sum of its lock counters, read after a fence.
+//
+// Every wait for readers starts and ends with a full barrier on the
+// updater and, when the derived domain says its readers have no fences,
+// on every reader through membarrier(); the checks in between are plain
+// loads.  A reader whose increment the first barrier did not bring in
+// began its section after it, and sees what the updater did before.
+
+namespace std {
+namespace rcu {
+namespace detail {
+    class counter_domain {
+    public:
+	typedef unsigned int token;
+
+    protected:
+	// 128 bytes, which rcu_domain_rseq's restartable sequence relies on
+	struct CpuCounters {
+	    atomic<uint64_t> locks[2];
+	    atomic<uint64_t> unlocks[2];
+	    char pad[128 - 4*sizeof(atomic<uint64_t>)];
+	};
+	static_assert(sizeof(CpuCounters) == 128, "CpuCounters must fill one 128-byte line");
+
+    private:
+	static const int WAIT_SPINS = 100;          // Checks before sleeping
+	static const int WAIT_SLEEP_US = 10;        // First sleep, doubled up to...
+	static const int WAIT_SLEEP_MAX_US = 1000;  // ... this
+	static const int INLINE_GP_MS = 100;        // Longest retire() waits for its own grace period
+
+	struct Callback {
+	    rcu_head *rhp;
+	    void (*cbf)(rcu_head *rhp);
+	    callback_executor *executor;            // Null to invoke cbf directly
+	    void *context;                          // From executor->capture()
+	    size_t charged;                         // Against the reclaim budget
+
+	    void invoke() const noexcept
+	    {
+		if (executor == nullptr) cbf(rhp);
+		else executor->execute(context, rhp, cbf);
+	    }
+	};
+
+    protected:
+	const int numCpus;                          // Possible CPU ids, which bounds them
+	CpuCounters* const counters;
+	atomic<unsigned int> index alignas(128) = { 0 };
+
+    private:
+	const bool fenceFreeReaders;                // membarrier() stands in for reader fences
+
+	timed_mutex gpMutex;                        // Serializes grace periods
+	uint64_t gpRunning = 0;                     // Started, not completed; under gpMutex
+	unsigned int gpIndex = 0;                   // Its index before the flip
+	bool gpFlipped = false;                     // Whether it has flipped yet
+	atomic<uint64_t> gpStarted = { 0 };
+	atomic<uint64_t> gpCompleted = { 0 };
+	atomic<int> expediting = { 0 };             // synchronize_expedited() callers
+
+	mutex cbMutex;                              // Protects everything below
+	condition_variable wakeup;
+	condition_variable done;
+	vector<Callback> pending;
+	vector<Callback> urgent;
+	uint64_t retired = 0;                       // Sequence of the last retire()...
+	uint64_t invoked = 0;                       // ... and of the last one invoked, in order
+	uint64_t urgentRetired = 0;                 // The same for retire_urgent()
+	uint64_t urgentInvoked = 0;
+	long budgetItems = 0;                       // Per batch, 0 for no limit
+	long budgetMicroseconds = 0;                // Per batch, 0 for no limit
+	atomic<callback_executor*> executor = { nullptr };
+	reclaim_budget reclaimBudget;
+	bool stopping = false;
+	thread callbackThread;
+
+    protected:
+	explicit counter_domain(const bool fenceFreeReaders)
+	    : numCpus(num_cpus()), counters(new CpuCounters[numCpus]), fenceFreeReaders(fenceFreeReaders)
+	{
+	    for (int i = 0; i < numCpus; i++) {
+		for (int j = 0; j < 2; j++) {
+		    counters[i].locks[j].store(0, memory_order_relaxed);
+		    counters[i].unlocks[j].store(0, memory_order_relaxed);
+		}
+	    }
+	    callbackThread = thread(&counter_domain::callback_loop, this);
+	}
+
+	~counter_domain()
+	{
+	    {
+		lock_guard<mutex> lock(cbMutex);
+		stopping = true;
+		wakeup.notify_one();
+	    }
+	    callbackThread.join();
+	    delete[] counters;
+	}
+
+    public:
+	counter_domain(const counter_domain&) = delete;
+	counter_domain& operator=(const counter_domain&) = delete;
+
+	static constexpr bool register_thread_needed() { return false; }
+	void register_thread() {}
+	void unregister_thread() {}
+	void thread_offline() noexcept {}
+	void thread_online() noexcept {}
+
+	static constexpr bool quiescent_state_needed() { return false; }
+	void quiescent_state() noexcept {}
+
+	void synchronize() noexcept { synchronize_until(gpStarted.load() + 1, gp_deadline::max()); }
+
+	bool try_synchronize(const gp_state cookie) noexcept
+	{
+	    return synchronize_until(cookie, gp_deadline::min());
+	}
+
+	// A grace period that times out stays in gpRunning, and the next caller
+	// carries on from the phase it reached.
+	bool synchronize_until(const gp_state cookie, const gp_deadline deadline) noexcept
+	{
+	    if (poll_state(cookie)) return true;
+	    unique_lock<timed_mutex> lock(gpMutex, defer_lock);
+	    if (deadline == gp_deadline::max()) lock.lock();
+	    else if (!lock.try_lock_until(deadline)) return false;
+	    while (gpCompleted.load() < cookie) {
+		if (gpRunning == 0) {
+		    gpRunning = gpStarted.load() + 1;
+		    gpStarted.store(gpRunning);
+		    gpIndex = index.load(memory_order_relaxed) & 1;
+		    gpFlipped = false;
+		}
+		if (!gpFlipped) {
+		    if (!wait_for_readers(gpIndex ^ 1, deadline)) return false;
+		    index.store(gpIndex ^ 1, memory_order_relaxed);
+		    gpFlipped = true;
+		}
+		if (!wait_for_readers(gpIndex, deadline)) return false;
+		gpCompleted.store(gpRunning);
+		gpRunning = 0;
+	    }
+	    return true;
+	}
+
+	// Also hurries a grace period that is already running, such as the
+	// callback thread's, which holds the mutex: while any expedited caller
+	// waits, waits for readers poll every WAIT_SLEEP_US without backing off.
+	void synchronize_expedited() noexcept
+	{
+	    expediting.fetch_add(1);
+	    synchronize();
+	    expediting.fetch_sub(1);
+	}
+
+	gp_state get_state() noexcept { return gpStarted.load() + 1; }
+	bool poll_state(const gp_state cookie) noexcept { return gpCompleted.load() >= cookie; }
+	void cond_synchronize(const gp_state cookie) noexcept
+	{
+	    if (!poll_state(cookie)) synchronize();
+	}
+
+	void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), const size_t bytes = 0)
+	{
+	    size_t charged;
+	    const bool admitted = reclaimBudget.admit(bytes, charged, true);
+	    callback_executor* const ex = executor.load(memory_order_acquire);
+	    Callback cb{rhp, cbf, ex, (ex == nullptr) ? nullptr : ex->capture(), charged};
+	    if (!admitted) {
+		// Over the hard limit: reclaim it here, executor and all.  Read
+		// sections are not tied to threads, so there is no telling
+		// whether the caller is in one, which would hold up the grace
+		// period for good; past a deadline the object is queued anyway.
+		const int timeoutMs = INLINE_GP_MS;
+		if (synchronize_until(get_state(), chrono::steady_clock::now() + chrono::milliseconds(timeoutMs))) {
+		    cb.invoke();
+		    return;
+		}
+		cb.charged = reclaimBudget.charge(bytes);
+	    }
+	    lock_guard<mutex> lock(cbMutex);
+	    pending.push_back(cb);
+	    retired++;
+	    wakeup.notify_one();
+	}
+
+	void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp))
+	{
+	    lock_guard<mutex> lock(cbMutex);
+	    urgent.push_back(Callback{rhp, cbf, nullptr, nullptr, 0});
+	    urgentRetired++;
+	    wakeup.notify_one();
+	}
+
+	void set_callback_budget(const long maxItems, const long maxMicroseconds) noexcept
+	{
+	    lock_guard<mutex> lock(cbMutex);
+	    budgetItems = maxItems < 0 ? 0 : maxItems;
+	    budgetMicroseconds = maxMicroseconds < 0 ? 0 : maxMicroseconds;
+	}
+
+	void set_callback_executor(callback_executor* const ex) noexcept
+	{
+	    executor.store(ex, memory_order_release);
+	}
+
+	void set_reclaim_budget(const size_t softBytes, const size_t hardBytes,
+				const over_hard_limit policy = over_hard_limit::reclaim_inline) noexcept
+	{
+	    reclaimBudget.set(softBytes, hardBytes, policy);
+	}
+	size_t pending_bytes() const noexcept { return reclaimBudget.pending_bytes(); }
+
+	void barrier() noexcept
+	{
+	    unique_lock<mutex> lock(cbMutex);
+	    // Each lane is invoked in the order it was retired
+	    const uint64_t target = retired;
+	    const uint64_t urgentTarget = urgentRetired;
+	    done.wait(lock, [&]{ return invoked >= target && urgentInvoked >= urgentTarget; });
+	}
+
+    protected:
+	// For the atomic counters; the kernel never hands out a CPU id past
+	// numCpus, but the modulo keeps a bad one in bounds
+	int my_cpu() const noexcept
+	{
+#ifdef __linux__
+	    const int cpu = sched_getcpu();
+	    if (cpu >= 0) return cpu % numCpus;
+#endif
+	    return 0;
+	}
+
+#if defined(__linux__) && defined(__NR_membarrier)
+	static bool membarrier_register() noexcept
+	{
+	    const long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+	    if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) return false;
+	    return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+	}
+	static void membarrier() noexcept
+	{
+	    syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+	}
+#else
+	static bool membarrier_register() noexcept { return false; }
+	static void membarrier() noexcept {}
+#endif
+
+    private:
+	// The highest CPU id the kernel may ever use, plus one, hotplugged
+	// CPUs included
+	static int num_cpus() noexcept
+	{
+#ifdef __linux__
+	    if (FILE* f = fopen("/sys/devices/system/cpu/possible", "r")) {
+		int last = -1, n;
+		char sep;
+		while (fscanf(f, "%d", &n) == 1) {
+		    if (n > last) last = n;
+		    if (fscanf(f, "%c", &sep) != 1) break;
+		}
+		fclose(f);
+		if (last >= 0) return last + 1;
+	    }
+	    const long n = sysconf(_SC_NPROCESSORS_CONF);
+	    if (n > 0) return (int)n;
+#endif
+	    const unsigned int n2 = thread::hardware_concurrency();
+	    return n2 > 0 ? (int)n2 : 1;
+	}
+
+	// A full barrier here and on every reader
+	void full_barrier() noexcept
+	{
+	    if (fenceFreeReaders) membarrier();
+	    else atomic_thread_fence(memory_order_seq_cst);
+	}
+
+	bool readers_gone(const unsigned int idx) noexcept
+	{
+	    uint64_t unlocks = 0;
+	    for (int i = 0; i < numCpus; i++) unlocks += counters[i].unlocks[idx].load(memory_order_relaxed);
+	    // Pairs with the fence between the increment and the section
+	    // in read_lock(), or with the order of a reader's own stores
+	    atomic_thread_fence(memory_order_seq_cst);
+	    uint64_t locks = 0;
+	    for (int i = 0; i < numCpus; i++) locks += counters[i].locks[idx].load(memory_order_relaxed);
+	    return locks == unlocks;
+	}
+
+	// Readers may sleep, so back off to sleeping quickly
+	// False if the deadline passed first
+	bool wait_for_readers(const unsigned int idx, const gp_deadline deadline) noexcept
+	{
+	    const bool timed = deadline != gp_deadline::max();
+	    int sleepUs = WAIT_SLEEP_US;
+	    full_barrier();
+	    for (int i = 0; !readers_gone(idx); i++) {
+		if (timed && chrono::steady_clock::now() >= deadline) return false;
+		if (i < WAIT_SPINS) continue;
+		if (timed) this_thread::sleep_until(std::min(deadline, chrono::steady_clock::now() +
+							     chrono::microseconds(sleepUs)));
+		else this_thread::sleep_for(chrono::microseconds(sleepUs));
+		if (expediting.load(memory_order_relaxed) != 0) sleepUs = WAIT_SLEEP_US;
+		else if (sleepUs < WAIT_SLEEP_MAX_US) sleepUs *= 2;
+	    }
+	    full_barrier();
+	    return true;
+	}
+
+	void callback_loop()
+	{
+	    deque<Callback> ready;                  // Past their grace period, over budget
+	    vector<Callback> batch;
+	    vector<Callback> urgentBatch;
+	    unique_lock<mutex> lock(cbMutex);
+	    for (;;) {
+		wakeup.wait(lock, [&]{
+		    return stopping || !pending.empty() || !urgent.empty() || !ready.empty();
+		});
+		if (stopping && pending.empty() && urgent.empty() && ready.empty()) break;
+		batch.swap(pending);
+		urgentBatch.swap(urgent);
+		// Past the soft limit, drain the backlog as fast as possible
+		const bool drain = reclaimBudget.over_soft();
+		const long maxItems = drain ? 0 : budgetItems;
+		const long maxMicroseconds = drain ? 0 : budgetMicroseconds;
+		lock.unlock();
+
+		if (!batch.empty() || !urgentBatch.empty()) {
+		    if (drain) synchronize_expedited();
+		    else synchronize();
+		}
+		uint64_t n = 0;
+		for (const Callback& cb : urgentBatch) cb.invoke();
+		const uint64_t urgentN = urgentBatch.size();
+		urgentBatch.clear();
+		ready.insert(ready.end(), batch.begin(), batch.end());
+		batch.clear();
+		const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (long i = 0; !ready.empty(); i++) {
+		    if (maxItems != 0 && i >= maxItems) break;
+		    if (maxMicroseconds != 0 && i != 0 &&
+			chrono::steady_clock::now() - start >= chrono::microseconds(maxMicroseconds)) break;
+		    const Callback cb = ready.front();
+		    ready.pop_front();
+		    cb.invoke();
+		    reclaimBudget.credit(cb.charged);
+		    n++;
+		}
+
+		lock.lock();
+		invoked += n;
+		urgentInvoked += urgentN;
+		done.notify_all();
+	    }
+	}
+    };
+} // namespace detail
+} // namespace rcu
+} // namespace std
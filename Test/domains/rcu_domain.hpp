@@ -1,6 +1,17 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "rcu_stats.hpp"
+
 extern "C" struct rcu_head;
+extern "C" struct call_rcu_data;
 
 namespace std {
 namespace rcu {
@@ -12,6 +23,424 @@ namespace rcu {
     // the same semantics as class D (which must satisfy the RcuDomain concept).
     // http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2016/p0260r0.html#Binary
     //
+
+    // Grace-period cookie.  get_state() returns one once an object has been
+    // unpublished; poll_state() tells whether a full grace period has elapsed
+    // since, in which case the object may be freed right away, and
+    // cond_synchronize() waits for a grace period only if one has not.
+    typedef std::uint64_t gp_state;
+
+    // try_synchronize(cookie) and synchronize_until(cookie, deadline) wait
+    // for the grace period that cookie stands for, the first without
+    // blocking and the second until the deadline, and tell whether it has
+    // completed.  Whatever progress one call made is kept in the domain, so
+    // retrying with the same cookie resumes that grace period instead of
+    // starting a new one.
+    typedef std::chrono::steady_clock::time_point gp_deadline;
+
+    namespace detail {
+	// A domain's read_lock() either returns nothing, the section then being
+	// ended by read_unlock() on the same thread, or returns a token that
+	// read_unlock(token) accepts on any thread.  read_side<Domain> gives
+	// both kinds the token form, with an empty token for the first.
+	template<class Domain, class Token = decltype(declval<Domain&>().read_lock())>
+	struct read_side {
+	    typedef Token token;
+	    static token lock(Domain& d) noexcept { return d.read_lock(); }
+	    static void unlock(Domain& d, token t) noexcept { d.read_unlock(t); }
+
+	    // Thread-bound sections, for rcu_domain_wrapper: keep the tokens
+	    // on a per-thread stack, innermost last.
+	    static void lock_on_thread(Domain& d)
+	    {
+		thread_tokens().push_back(make_pair(&d, d.read_lock()));
+	    }
+	    static void unlock_on_thread(Domain& d) noexcept
+	    {
+		vector<pair<Domain *, token>>& tokens = thread_tokens();
+		for (auto it = tokens.end(); it != tokens.begin(); ) {
+		    if ((--it)->first == &d) {
+			d.read_unlock(it->second);
+			tokens.erase(it);
+			return;
+		    }
+		}
+	    }
+	    static vector<pair<Domain *, token>>& thread_tokens()
+	    {
+		static thread_local vector<pair<Domain *, token>> tokens;
+		return tokens;
+	    }
+	};
+
+	template<class Domain>
+	struct read_side<Domain, void> {
+	    struct token {};
+	    static token lock(Domain& d) noexcept { d.read_lock(); return token(); }
+	    static void unlock(Domain& d, token) noexcept { d.read_unlock(); }
+	    static void lock_on_thread(Domain& d) noexcept { d.read_lock(); }
+	    static void unlock_on_thread(Domain& d) noexcept { d.read_unlock(); }
+	};
+
+	template<class Domain>
+	auto has_read_side(Domain& d, int) -> decltype(d.read_unlock(d.read_lock()), true_type());
+	template<class Domain>
+	auto has_read_side(Domain& d, long) -> decltype(d.read_lock(), d.read_unlock(), true_type());
+	template<class Domain>
+	false_type has_read_side(Domain& d, ...);
+
+	// Polls until done() or the deadline, sleeping from 10us up to 1ms
+	// between polls; for domains whose grace periods advance on their own.
+	template<class Done>
+	bool poll_until(Done done, const gp_deadline deadline) noexcept
+	{
+	    chrono::microseconds sleep(10);
+	    while (!done()) {
+		const gp_deadline now = chrono::steady_clock::now();
+		if (now >= deadline) return false;
+		if (deadline - now < sleep) this_thread::sleep_until(deadline);
+		else this_thread::sleep_for(sleep);
+		if (sleep < chrono::milliseconds(1)) sleep *= 2;
+	    }
+	    return true;
+	}
+
+	// Domain::process_wide() for domains that declare it, false for the rest
+	template<class Domain>
+	constexpr auto process_wide(int) -> decltype(Domain::process_wide(), bool())
+	{
+	    return Domain::process_wide();
+	}
+
+	template<class Domain>
+	constexpr bool process_wide(long)
+	{
+	    return false;
+	}
+    } // namespace detail
+
+    // What read_lock(d) returns and read_unlock(d, token) takes, for
+    // generic code that handles either kind of domain.
+    template<class Domain>
+    using read_token = typename detail::read_side<Domain>::token;
+
+    template<class Domain>
+    read_token<Domain> read_lock(Domain& d) noexcept { return detail::read_side<Domain>::lock(d); }
+
+    template<class Domain>
+    void read_unlock(Domain& d, read_token<Domain> t) noexcept { detail::read_side<Domain>::unlock(d, t); }
+
+    // Compile-time check for the core of the RcuDomain concept, for code
+    // that takes the domain as a template parameter and so calls straight
+    // into it.  rcu_domain_base satisfies it too, for when the domain is only
+    // known at run time.
+    template<class Domain, class = void>
+    struct is_rcu_domain : false_type {};
+
+    template<class Domain>
+    struct is_rcu_domain<Domain, decltype(
+	declval<Domain&>().retire(declval<rcu_head *>(), declval<void (*)(rcu_head *)>()),
+	declval<Domain&>().synchronize(),
+	declval<Domain&>().barrier(),
+	void())> : decltype(detail::has_read_side(declval<Domain&>(), 0)) {};
+
+#if __cpp_concepts
+    template<class Domain>
+    concept RcuDomain = is_rcu_domain<Domain>::value;
+#endif
+
+    // The instance used when no domain object is named.  Only for domains
+    // whose readers and grace periods are process-wide, which say so with a
+    // process_wide() that returns true, such as the liburcu flavors, whose
+    // constexpr default constructor makes this a constant-initialized object
+    // with no guard.  Any other domain would silently get a hidden instance
+    // of its own, which no updater waits on.
+    template<class Domain>
+    struct default_domain {
+	static_assert(detail::process_wide<Domain>(0),
+		      "only a process-wide domain has a default instance; name the domain object");
+	static Domain instance;
+    };
+
+    template<class Domain>
+    Domain default_domain<Domain>::instance;
+
+    // Runs callbacks once their grace period is over, in place of the
+    // domain's own callback thread (see set_callback_executor()).  retire()
+    // calls capture() on the retiring thread, and execute() later receives
+    // its result along with the callback; execute() may run the callback
+    // right away or queue it anywhere, as long as it eventually runs.
+    // set_callback_executor() applies to callbacks retired from then on,
+    // nullptr handing them back to the domain, and the executor must
+    // outlive every callback handed to it.
+    class callback_executor {
+    public:
+	virtual ~callback_executor() = default;
+	virtual void *capture() noexcept { return nullptr; }
+	virtual void execute(void *context, rcu_head *rhp, void (*cbf)(rcu_head *rhp)) noexcept = 0;
+    };
+
+    // What retire() does with an object that would take the bytes pending
+    // reclamation past the hard limit of set_reclaim_budget(): wait for a
+    // grace period and reclaim the object on the spot, or block until enough
+    // earlier objects have been reclaimed.  A retire() inside a read-side
+    // critical section can do neither, since no grace period can end while
+    // it runs, so the object is queued past the limit instead.  The domains
+    // that cannot tell (rcu_domain_srcu, rcu_domain_rseq) give up on the
+    // grace period after a while and do the same, but cannot save a reader
+    // from blocking.  A callback that retires must not block either, since
+    // it would hold up the very callbacks it waits for.
+    // Domains whose callbacks only run on retiring threads (rcu_domain_ebr,
+    // rcu_domain_hp) and rcu_domain_qsbr always reclaim inline.
+    enum class over_hard_limit { reclaim_inline, block };
+
+    namespace detail {
+	// Bytes retired but not yet reclaimed, against the limits of
+	// set_reclaim_budget(), zero meaning none.  Only objects retired with
+	// a size while some limit is set are counted.  Plain atomics, so that
+	// the liburcu flavors stay constant-initialized.
+	class reclaim_budget {
+	    atomic<size_t> pending = { 0 };
+	    atomic<size_t> softLimit = { 0 };
+	    atomic<size_t> hardLimit = { 0 };
+	    atomic<bool> blockOverHard = { false };
+
+	public:
+	    void set(const size_t soft, const size_t hard, const over_hard_limit policy) noexcept
+	    {
+		softLimit.store(soft, memory_order_relaxed);
+		hardLimit.store(hard, memory_order_relaxed);
+		blockOverHard.store(policy == over_hard_limit::block, memory_order_relaxed);
+	    }
+
+	    size_t pending_bytes() const noexcept { return pending.load(memory_order_relaxed); }
+
+	    // Time to expedite grace periods and bring in extra workers
+	    bool over_soft() const noexcept
+	    {
+		const size_t soft = softLimit.load(memory_order_relaxed);
+		return soft != 0 && pending.load(memory_order_relaxed) > soft;
+	    }
+
+	    // Called by retire() before queueing an object of the given size.
+	    // Returns false if the caller must instead synchronize and invoke
+	    // the callback itself; otherwise charged is what to credit() once
+	    // the callback has run.  An object bigger than the hard limit on
+	    // its own is let through once nothing else is pending.  The check
+	    // and the charge are one compare-and-swap, so that concurrent
+	    // retirers cannot all squeeze in under the limit.
+	    bool admit(const size_t bytes, size_t& charged, const bool canBlock)
+	    {
+		charged = 0;
+		if (bytes == 0) return true;
+		if (hardLimit.load(memory_order_relaxed) == 0 && softLimit.load(memory_order_relaxed) == 0) return true;
+		const bool block = canBlock && blockOverHard.load(memory_order_relaxed);
+		size_t p = pending.load();
+		for (;;) {
+		    const size_t h = hardLimit.load(memory_order_relaxed);
+		    if (h == 0 || p + bytes <= h || (block && p == 0)) {
+			if (pending.compare_exchange_weak(p, p + bytes)) break;
+			continue;
+		    }
+		    if (!block) return false;
+		    poll_until([this, bytes]{
+			const size_t h = hardLimit.load(memory_order_relaxed);
+			const size_t p = pending.load();
+			return h == 0 || p == 0 || p + bytes <= h;
+		    }, gp_deadline::max());
+		    p = pending.load();
+		}
+		charged = bytes;
+		return true;
+	    }
+
+	    // For an object admit() turned away whose retire() can neither
+	    // synchronize nor block, such as one inside a read-side critical
+	    // section: charges it past the hard limit, to be queued as usual.
+	    size_t charge(const size_t bytes) noexcept
+	    {
+		pending.fetch_add(bytes);
+		return bytes;
+	    }
+
+	    void credit(const size_t bytes) noexcept
+	    {
+		if (bytes != 0) pending.fetch_sub(bytes);
+	    }
+	};
+
+	// Stands in for an object retired to a domain that can only call back
+	// with an rcu_head pointer, such as liburcu's call_rcu().  Head is
+	// rcu_head, a parameter so that it only needs to be complete where used.
+	template<class Head>
+	struct retire_node {
+	    Head head;
+	    rcu_head *rhp;
+	    void (*cbf)(rcu_head *rhp);
+	    callback_executor *ex;		// Null to invoke cbf directly
+	    void *context;
+	    reclaim_budget *budget;
+	    size_t charged;
+	    stats_registry *stats;		// Null when not counted
+	    uint64_t retiredNs;
+	    size_t bytes;
+
+	    void count_retired(stats_registry& r, const size_t size)
+	    {
+		stats = &r;
+		retiredNs = now_ns();
+		bytes = size;
+		stats_block& b = r.local();
+		bump(b.retired);
+		bump(b.retiredBytes, size);
+	    }
+
+	    static void invoke(rcu_head *h) noexcept
+	    {
+		retire_node *n = reinterpret_cast<retire_node *>(h);
+		if (n->ex == nullptr) n->cbf(n->rhp);
+		else n->ex->execute(n->context, n->rhp, n->cbf);
+		n->budget->credit(n->charged);
+		if (n->stats != nullptr) n->stats->local().count_invoked(n->bytes, n->retiredNs, now_ns());
+		delete n;
+	    }
+	};
+
+	// The callback side of the liburcu flavor wrappers, written against
+	// the flavor's own functions, which liburcu's headers name by macro.
+	// Past the soft limit of the reclaim budget, retire() queues on an
+	// overflow call_rcu worker, since liburcu cannot hurry grace periods;
+	// urgent callbacks get a worker of their own, so that they do not wait
+	// behind the default worker's backlog.  Tag picks the flavor_stats.
+	// Plain members, so that the wrappers stay constant-initialized.
+	template<class Tag, class Head,
+		 void (*CallRcu)(Head *, void (*)(Head *)),
+		 void (*SynchronizeRcu)(),
+		 int (*ReadOngoing)(),
+		 call_rcu_data *(*CreateCallRcuData)(unsigned long, int),
+		 call_rcu_data *(*GetThreadCallRcuData)(),
+		 void (*SetThreadCallRcuData)(call_rcu_data *)>
+	class urcu_callbacks {
+	    atomic<callback_executor *> executor = { nullptr };
+	    reclaim_budget budget;
+
+	public:
+	    typedef flavor_stats<Tag> stats_type;
+
+	    void retire(Head *rhp, void (*cbf)(Head *rhp), const size_t bytes, const bool canBlock)
+	    {
+		size_t charged;
+		const bool inSection = ReadOngoing() != 0;
+		bool admitted = budget.admit(bytes, charged, canBlock && !inSection);
+		if (!admitted && inSection) {
+		    // The grace period would wait for this very reader
+		    charged = budget.charge(bytes);
+		    admitted = true;
+		}
+		callback_executor *ex = executor.load(memory_order_acquire);
+		const bool counted = stats_type::collect().load(memory_order_relaxed);
+		if (admitted && ex == nullptr && charged == 0 && !counted) {
+		    queue(rhp, cbf);
+		    return;
+		}
+		// call_rcu() keeps nothing but the head, so the executor, the
+		// charge, the counts and the real callback travel in a node of
+		// their own.
+		typedef retire_node<Head> node;
+		node *n = new node{Head(), rhp, cbf, ex, (ex == nullptr) ? nullptr : ex->capture(),
+				   &budget, charged, nullptr, 0, 0};
+		if (counted) n->count_retired(stats_type::registry(), bytes);
+		if (admitted) {
+		    queue(&n->head, node::invoke);
+		} else {
+		    // Over the hard limit: the grace period here, the rest as
+		    // the call_rcu worker would have done it
+		    synchronize();
+		    node::invoke(&n->head);
+		}
+	    }
+
+	    void retire_urgent(Head *rhp, void (*cbf)(Head *rhp))
+	    {
+		static call_rcu_data *urgent = CreateCallRcuData(0, -1);
+		call_rcu_on(urgent, rhp, cbf);
+	    }
+
+	    void set_callback_executor(callback_executor *ex) noexcept
+	    {
+		executor.store(ex, memory_order_release);
+	    }
+
+	    void set_reclaim_budget(size_t softBytes, size_t hardBytes, over_hard_limit policy) noexcept
+	    {
+		budget.set(softBytes, hardBytes, policy);
+	    }
+	    size_t pending_bytes() const noexcept { return budget.pending_bytes(); }
+
+	    static void synchronize() noexcept { stats_type::time_grace_period(SynchronizeRcu); }
+
+	private:
+	    void queue(Head *rhp, void (*cbf)(Head *rhp))
+	    {
+		if (!budget.over_soft()) {
+		    CallRcu(rhp, cbf);
+		    return;
+		}
+		static call_rcu_data *overflow = CreateCallRcuData(0, -1);
+		call_rcu_on(overflow, rhp, cbf);
+	    }
+
+	    static void call_rcu_on(call_rcu_data *crdp, Head *rhp, void (*cbf)(Head *rhp))
+	    {
+		call_rcu_data *saved = GetThreadCallRcuData();
+		SetThreadCallRcuData(crdp);
+		CallRcu(rhp, cbf);
+		SetThreadCallRcuData(saved);
+	    }
+	};
+
+	// retire() with the object's size, for domains that take one
+	template<class Domain>
+	auto retire_sized(Domain& d, rcu_head *rhp, void (*cbf)(rcu_head *rhp), const size_t bytes, int)
+	    -> decltype(d.retire(rhp, cbf, bytes))
+	{
+	    return d.retire(rhp, cbf, bytes);
+	}
+
+	template<class Domain>
+	void retire_sized(Domain& d, rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t, long)
+	{
+	    d.retire(rhp, cbf);
+	}
+
+	// stats() for domains that have it, an empty snapshot for the rest
+	template<class Domain>
+	auto stats_of(Domain& d, int) -> decltype(d.stats())
+	{
+	    return d.stats();
+	}
+
+	template<class Domain>
+	domain_stats stats_of(Domain&, long)
+	{
+	    return domain_stats();
+	}
+
+	// synchronize_expedited() for domains that have it, synchronize() for
+	// the rest
+	template<class Domain>
+	auto synchronize_expedited(Domain& d, int) noexcept -> decltype(d.synchronize_expedited())
+	{
+	    d.synchronize_expedited();
+	}
+
+	template<class Domain>
+	void synchronize_expedited(Domain& d, long) noexcept
+	{
+	    d.synchronize();
+	}
+    } // namespace detail
+
     class rcu_domain_base {
     public:
 	rcu_domain_base() noexcept = default;
@@ -30,10 +459,33 @@ namespace rcu {
 	virtual void read_lock() noexcept = 0;
 	virtual void read_unlock() noexcept = 0;
 
-	virtual void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) = 0;
+	// bytes is the size of the object, counted against set_reclaim_budget()
+	virtual void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t bytes = 0) = 0;
+	// Like retire(), but ahead of any backlog of ordinary callbacks
+	virtual void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) = 0;
+	// Callbacks invoked per batch, by count and by time; zero means no limit
+	virtual void set_callback_budget(long max_items, long max_microseconds) noexcept = 0;
+	// Where retire() callbacks run from now on; nullptr for the domain's
+	// own thread.  Urgent callbacks always run there.
+	virtual void set_callback_executor(callback_executor *ex) noexcept = 0;
+	// Limits on the bytes retired but not yet reclaimed; zero means none
+	virtual void set_reclaim_budget(size_t soft_bytes, size_t hard_bytes,
+					over_hard_limit policy = over_hard_limit::reclaim_inline) noexcept = 0;
+	virtual size_t pending_bytes() const noexcept = 0;
+	// A snapshot of the domain's counters; see rcu_stats.hpp
+	virtual domain_stats stats() = 0;
 
 	virtual void synchronize() noexcept = 0;
+	// A grace period as soon as possible, paid for in updater CPU time.
+	// Domains without one, such as the liburcu flavors, run synchronize().
+	virtual void synchronize_expedited() noexcept = 0;
+	virtual bool try_synchronize(gp_state cookie) noexcept = 0;
+	virtual bool synchronize_until(gp_state cookie, gp_deadline deadline) noexcept = 0;
 	virtual void barrier() noexcept = 0;
+
+	virtual gp_state get_state() noexcept = 0;
+	virtual bool poll_state(gp_state cookie) noexcept = 0;
+	virtual void cond_synchronize(gp_state cookie) noexcept = 0;
     };
 
     template<class Domain>
@@ -51,13 +503,49 @@ namespace rcu {
 	bool quiescent_state_needed() const noexcept override { return d->quiescent_state_needed(); }
 	void quiescent_state() noexcept override { d->quiescent_state(); }
 
-	void read_lock() noexcept override { d->read_lock(); }
-	void read_unlock() noexcept override { d->read_unlock(); }
+	void read_lock() noexcept override { detail::read_side<Domain>::lock_on_thread(*d); }
+	void read_unlock() noexcept override { detail::read_side<Domain>::unlock_on_thread(*d); }
 
-	void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) override { d->retire(rhp, cbf); }
+	void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t bytes = 0) override
+	{
+		d->retire(rhp, cbf, bytes);
+	}
+	void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) override { d->retire_urgent(rhp, cbf); }
+	void set_callback_budget(long max_items, long max_microseconds) noexcept override
+	{
+		d->set_callback_budget(max_items, max_microseconds);
+	}
+	void set_callback_executor(callback_executor *ex) noexcept override { d->set_callback_executor(ex); }
+	void set_reclaim_budget(size_t soft_bytes, size_t hard_bytes,
+				over_hard_limit policy = over_hard_limit::reclaim_inline) noexcept override
+	{
+		d->set_reclaim_budget(soft_bytes, hard_bytes, policy);
+	}
+	size_t pending_bytes() const noexcept override { return d->pending_bytes(); }
+	domain_stats stats() override { return detail::stats_of(*d, 0); }
 
 	void synchronize() noexcept override { d->synchronize(); }
+	void synchronize_expedited() noexcept override { detail::synchronize_expedited(*d, 0); }
+	bool try_synchronize(gp_state cookie) noexcept override { return d->try_synchronize(cookie); }
+	bool synchronize_until(gp_state cookie, gp_deadline deadline) noexcept override
+	{
+		return d->synchronize_until(cookie, deadline);
+	}
 	void barrier() noexcept override { d->barrier(); }
+
+	gp_state get_state() noexcept override { return d->get_state(); }
+	bool poll_state(gp_state cookie) noexcept override { return d->poll_state(cookie); }
+	void cond_synchronize(gp_state cookie) noexcept override { d->cond_synchronize(cookie); }
     };
+
+    // synchronize_until() with a timeout, for any domain
+    template<class Domain, class Rep, class Period>
+    bool synchronize_for(Domain& d, gp_state cookie, const chrono::duration<Rep, Period>& timeout) noexcept
+    {
+	const gp_deadline now = chrono::steady_clock::now();
+	if (timeout >= chrono::duration_cast<chrono::duration<Rep, Period>>(gp_deadline::max() - now))
+	    return d.synchronize_until(cookie, gp_deadline::max());
+	return d.synchronize_until(cookie, now + chrono::duration_cast<chrono::steady_clock::duration>(timeout));
+    }
 } // namespace rcu
 } // namespace std
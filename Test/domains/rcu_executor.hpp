@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <utility>
+#include "rcu_domain.hpp"
+
+// Callback executors to hand to a domain's set_callback_executor().  Any
+// class derived from rcu::callback_executor will do; this one returns each
+// callback to the thread that retired the object.
+//
+// Freeing memory on the thread that allocated it keeps allocator caches
+// warm and avoids the cross-thread frees that a single callback thread
+// turns every object into.  An updater mostly retires versions that it
+// published itself, so the retiring thread stands in for the allocating
+// one: thread_return_executor notes it in capture(), and execute() queues
+// the callback there.  The thread runs its queue when it calls
+// run_pending(), from its event loop or between operations, and when it
+// exits.  A queue left by an exited thread is taken over by the next thread
+// to retire through the executor; until then callbacks for it run right
+// away on the domain's thread.
+//
+// A thread that retires but never calls run_pending() holds on to its
+// callbacks until it exits, and barrier() on the domain does not wait for
+// queued callbacks, only for their hand-over.
+
+namespace std {
+namespace rcu {
+    class thread_return_executor : public callback_executor {
+	typedef pair<rcu_head *, void (*)(rcu_head *)> callback;
+
+	struct queue {
+	    mutex m;
+	    vector<callback> items;
+	    bool attached = true;		// A thread is running it
+	    atomic<const thread_return_executor *> owner;	// Null once that is gone
+
+	    explicit queue(const thread_return_executor *e) : owner(e) {}
+
+	    // The thread is done with it
+	    void detach()
+	    {
+		vector<callback> batch;
+		{
+		    lock_guard<mutex> lock(m);
+		    batch.swap(items);
+		    attached = false;
+		}
+		for (const callback& cb : batch) cb.second(cb.first);
+	    }
+	};
+
+	// This thread's queues, one per executor it has retired through
+	struct thread_queues {
+	    vector<shared_ptr<queue>> queues;
+	    ~thread_queues() { for (auto& q : queues) q->detach(); }
+	};
+
+	static thread_queues& mine()
+	{
+	    static thread_local thread_queues tq;
+	    return tq;
+	}
+
+	mutex m;
+	vector<shared_ptr<queue>> all;		// Attached or waiting to be taken over
+
+	queue *my_queue(const bool create)
+	{
+	    vector<shared_ptr<queue>>& qs = mine().queues;
+	    for (size_t i = 0; i < qs.size(); ) {
+		const thread_return_executor *owner = qs[i]->owner.load(memory_order_acquire);
+		if (owner == this) return qs[i].get();
+		if (owner == nullptr) {
+		    qs[i]->detach();
+		    qs.erase(qs.begin() + i);
+		} else {
+		    i++;
+		}
+	    }
+	    if (!create) return nullptr;
+
+	    lock_guard<mutex> lock(m);
+	    for (const shared_ptr<queue>& q : all) {
+		lock_guard<mutex> qlock(q->m);
+		if (!q->attached) {
+		    q->attached = true;
+		    qs.push_back(q);
+		    return q.get();
+		}
+	    }
+	    all.push_back(make_shared<queue>(this));
+	    qs.push_back(all.back());
+	    return all.back().get();
+	}
+
+    public:
+	thread_return_executor() = default;
+	thread_return_executor(const thread_return_executor&) = delete;
+	thread_return_executor& operator=(const thread_return_executor&) = delete;
+
+	~thread_return_executor()
+	{
+	    lock_guard<mutex> lock(m);
+	    for (const shared_ptr<queue>& q : all) q->owner.store(nullptr, memory_order_release);
+	}
+
+	void *capture() noexcept override { return my_queue(true); }
+
+	void execute(void *context, rcu_head *rhp, void (*cbf)(rcu_head *rhp)) noexcept override
+	{
+	    queue *q = static_cast<queue *>(context);
+	    {
+		lock_guard<mutex> lock(q->m);
+		if (q->attached) {
+		    q->items.push_back(callback(rhp, cbf));
+		    return;
+		}
+	    }
+	    cbf(rhp);
+	}
+
+	// Runs the callbacks queued for this thread so far; returns how many
+	size_t run_pending()
+	{
+	    queue *q = my_queue(false);
+	    if (q == nullptr) return 0;
+	    vector<callback> batch;
+	    {
+		lock_guard<mutex> lock(q->m);
+		batch.swap(q->items);
+	    }
+	    for (const callback& cb : batch) cb.second(cb.first);
+	    return batch.size();
+	}
+    };
+} // namespace rcu
+} // namespace std
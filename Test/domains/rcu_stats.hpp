@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Reclamation health, as reported by a domain's stats().  Every thread that
+// retires, invokes callbacks or waits for grace periods counts into a block
+// of its own, which only it writes; stats() adds the blocks up, so none of
+// that costs the counting threads a shared cache line.  The counts are not
+// taken at one instant, so pending figures may be slightly off while
+// callbacks are in flight.
+
+namespace std {
+namespace rcu {
+    // Durations in power-of-two buckets of microseconds: bucket 0 counts
+    // those under 1us, bucket i those under 2^i us, and the last bucket
+    // everything longer.  sum_ns adds up every duration counted.
+    struct latency_histogram {
+	static const int BUCKETS = 32;
+	uint64_t counts[BUCKETS] = {};
+	uint64_t sum_ns = 0;
+
+	static int bucket(const uint64_t ns) noexcept
+	{
+	    const uint64_t us = ns / 1000;
+	    if (us == 0) return 0;
+	    const int b = 64 - __builtin_clzll(us);
+	    return b < BUCKETS ? b : BUCKETS - 1;
+	}
+
+	uint64_t total() const noexcept
+	{
+	    uint64_t n = 0;
+	    for (uint64_t c : counts) n += c;
+	    return n;
+	}
+    };
+
+    struct domain_stats {
+	// Which of the fields below the domain fills in
+	enum : unsigned {
+	    grace_periods_measured = 1,		// grace_periods, grace_period_latency
+	    callbacks_measured = 2,		// pending_*, retire_to_free
+	    read_sections_measured = 4,		// max_read_section_us
+	    readers_measured = 8,		// readers
+	};
+	unsigned measured = 0;
+
+	uint64_t grace_periods = 0;		// Completed
+	latency_histogram grace_period_latency;	// Of the waits that completed one
+	uint64_t pending_callbacks = 0;		// Retired, not yet invoked
+	uint64_t pending_bytes = 0;		// Of those, for objects retired with a size
+	latency_histogram retire_to_free;	// From retire() to the callback
+	uint64_t max_read_section_us = 0;	// Longest observed
+	uint64_t readers = 0;			// Registered threads
+    };
+
+    // Writes s in the Prometheus text format, each sample labelled with the
+    // domain's name; fields that the domain does not measure are left out.
+    inline void write_stats(ostream& os, const domain_stats& s, const char *domain)
+    {
+	const auto sample = [&](const char *name, const char *extra, uint64_t v) {
+	    os << "rcu_" << name << "{domain=\"" << domain << "\"" << extra << "} " << v << "\n";
+	};
+	const auto histogram = [&](const char *name, const latency_histogram& h) {
+	    os << "# TYPE rcu_" << name << " histogram\n";
+	    uint64_t cumulative = 0;
+	    for (int i = 0; i < latency_histogram::BUCKETS - 1; i++) {
+		cumulative += h.counts[i];
+		os << "rcu_" << name << "_bucket{domain=\"" << domain << "\",le=\"" << (uint64_t(1) << i)
+		   << "\"} " << cumulative << "\n";
+	    }
+	    sample((string(name) + "_bucket").c_str(), ",le=\"+Inf\"", h.total());
+	    sample((string(name) + "_sum").c_str(), "", h.sum_ns / 1000);
+	    sample((string(name) + "_count").c_str(), "", h.total());
+	};
+
+	if (s.measured & domain_stats::grace_periods_measured) {
+	    os << "# TYPE rcu_grace_periods_total counter\n";
+	    sample("grace_periods_total", "", s.grace_periods);
+	    histogram("grace_period_latency_us", s.grace_period_latency);
+	}
+	if (s.measured & domain_stats::callbacks_measured) {
+	    os << "# TYPE rcu_pending_callbacks gauge\n";
+	    sample("pending_callbacks", "", s.pending_callbacks);
+	    os << "# TYPE rcu_pending_bytes gauge\n";
+	    sample("pending_bytes", "", s.pending_bytes);
+	    histogram("retire_to_free_us", s.retire_to_free);
+	}
+	if (s.measured & domain_stats::read_sections_measured) {
+	    os << "# TYPE rcu_max_read_section_us gauge\n";
+	    sample("max_read_section_us", "", s.max_read_section_us);
+	}
+	if (s.measured & domain_stats::readers_measured) {
+	    os << "# TYPE rcu_readers gauge\n";
+	    sample("readers", "", s.readers);
+	}
+    }
+
+    namespace detail {
+	inline uint64_t now_ns() noexcept
+	{
+	    return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Only the owning thread writes, so no read-modify-write is needed
+	inline void bump(atomic<uint64_t>& c, const uint64_t n = 1) noexcept
+	{
+	    c.store(c.load(memory_order_relaxed) + n, memory_order_relaxed);
+	}
+
+	struct stats_histogram {
+	    atomic<uint64_t> counts[latency_histogram::BUCKETS] = {};
+	    atomic<uint64_t> sumNs = { 0 };
+
+	    void add(const uint64_t ns) noexcept
+	    {
+		bump(counts[latency_histogram::bucket(ns)]);
+		bump(sumNs, ns);
+	    }
+	    void add_to(latency_histogram& h) const noexcept
+	    {
+		for (int i = 0; i < latency_histogram::BUCKETS; i++)
+		    h.counts[i] += counts[i].load(memory_order_relaxed);
+		h.sum_ns += sumNs.load(memory_order_relaxed);
+	    }
+	};
+
+	// One thread's counters for one domain, a separate allocation
+	struct stats_block {
+	    atomic<uint64_t> retired = { 0 };
+	    atomic<uint64_t> retiredBytes = { 0 };
+	    atomic<uint64_t> invoked = { 0 };
+	    atomic<uint64_t> invokedBytes = { 0 };
+	    atomic<uint64_t> gracePeriods = { 0 };
+	    atomic<uint64_t> maxReadSectionNs = { 0 };
+	    stats_histogram gracePeriodLatency;
+	    stats_histogram retireToFree;
+	    atomic<bool> inUse = { true };	// Released when the thread exits
+
+	    void count_invoked(const size_t bytes, const uint64_t retiredNs, const uint64_t nowNs) noexcept
+	    {
+		bump(invoked);
+		bump(invokedBytes, bytes);
+		retireToFree.add(nowNs - retiredNs);
+	    }
+
+	    void count_read_section(const uint64_t ns) noexcept
+	    {
+		if (ns > maxReadSectionNs.load(memory_order_relaxed))
+		    maxReadSectionNs.store(ns, memory_order_relaxed);
+	    }
+	};
+
+	// A domain's stats blocks.  A thread finds its own through a short
+	// thread_local list keyed by the registry's id; blocks left by exited
+	// threads are handed to new ones, their counts carrying on.
+	class stats_registry {
+	    struct entry {
+		uint64_t id;
+		shared_ptr<stats_block> block;
+	    };
+
+	    struct thread_entries {
+		vector<entry> entries;
+		~thread_entries()
+		{
+		    for (const entry& e : entries) e.block->inUse.store(false, memory_order_release);
+		}
+	    };
+
+	    static thread_entries& mine()
+	    {
+		static thread_local thread_entries te;
+		return te;
+	    }
+
+	    static uint64_t next_id() noexcept
+	    {
+		static atomic<uint64_t> id(0);
+		return ++id;
+	    }
+
+	    const uint64_t id;
+	    mutex m;
+	    vector<shared_ptr<stats_block>> blocks;
+
+	    stats_block& attach(vector<entry>& entries)
+	    {
+		// Drop the entries of registries that are gone
+		for (size_t i = 0; i < entries.size(); ) {
+		    if (entries[i].block.use_count() == 1) entries.erase(entries.begin() + i);
+		    else i++;
+		}
+		lock_guard<mutex> lock(m);
+		for (const shared_ptr<stats_block>& b : blocks) {
+		    if (!b->inUse.load(memory_order_acquire)) {
+			b->inUse.store(true, memory_order_relaxed);
+			entries.push_back(entry{id, b});
+			return *b;
+		    }
+		}
+		blocks.push_back(make_shared<stats_block>());
+		entries.push_back(entry{id, blocks.back()});
+		return *blocks.back();
+	    }
+
+	public:
+	    stats_registry() : id(next_id()) {}
+	    stats_registry(const stats_registry&) = delete;
+	    stats_registry& operator=(const stats_registry&) = delete;
+
+	    // The calling thread's block
+	    stats_block& local()
+	    {
+		vector<entry>& entries = mine().entries;
+		for (const entry& e : entries)
+		    if (e.id == id) return *e.block;
+		return attach(entries);
+	    }
+
+	    // Adds every block into s, grace_periods included
+	    void collect(domain_stats& s)
+	    {
+		uint64_t retired = 0, retiredBytes = 0, invoked = 0, invokedBytes = 0, maxNs = 0;
+		lock_guard<mutex> lock(m);
+		for (const shared_ptr<stats_block>& b : blocks) {
+		    retired += b->retired.load(memory_order_relaxed);
+		    retiredBytes += b->retiredBytes.load(memory_order_relaxed);
+		    invoked += b->invoked.load(memory_order_relaxed);
+		    invokedBytes += b->invokedBytes.load(memory_order_relaxed);
+		    s.grace_periods += b->gracePeriods.load(memory_order_relaxed);
+		    const uint64_t ns = b->maxReadSectionNs.load(memory_order_relaxed);
+		    if (ns > maxNs) maxNs = ns;
+		    b->gracePeriodLatency.add_to(s.grace_period_latency);
+		    b->retireToFree.add_to(s.retire_to_free);
+		}
+		s.pending_callbacks = retired > invoked ? retired - invoked : 0;
+		s.pending_bytes = retiredBytes > invokedBytes ? retiredBytes - invokedBytes : 0;
+		s.max_read_section_us = maxNs / 1000;
+	    }
+	};
+
+	// The counters of a liburcu flavor, which keeps its grace periods and
+	// readers to itself.  Grace periods are those waited for by the
+	// wrapper's synchronize() and readers those registered through it.
+	// Callbacks cost retire() a node of their own to count, so they are
+	// counted only while collect() is on.  Like liburcu's own state, this
+	// is per flavor; Flavor is the wrapper class.
+	template<class Flavor>
+	class flavor_stats {
+	    static atomic<uint64_t>& registered() noexcept
+	    {
+		static atomic<uint64_t> n(0);
+		return n;
+	    }
+
+	public:
+	    static stats_registry& registry()
+	    {
+		static stats_registry *r = new stats_registry;	// For callbacks run at exit
+		return *r;
+	    }
+
+	    static atomic<bool>& collect() noexcept
+	    {
+		static atomic<bool> on(false);
+		return on;
+	    }
+
+	    static void reader_registered() noexcept { registered().fetch_add(1, memory_order_relaxed); }
+	    static void reader_unregistered() noexcept { registered().fetch_sub(1, memory_order_relaxed); }
+
+	    template<class Synchronize>
+	    static void time_grace_period(Synchronize synchronize)
+	    {
+		const uint64_t start = now_ns();
+		synchronize();
+		stats_block& b = registry().local();
+		bump(b.gracePeriods);
+		b.gracePeriodLatency.add(now_ns() - start);
+	    }
+
+	    static domain_stats snapshot(const bool countsReaders)
+	    {
+		domain_stats s;
+		s.measured = domain_stats::grace_periods_measured;
+		if (collect().load(memory_order_relaxed)) s.measured |= domain_stats::callbacks_measured;
+		if (countsReaders) {
+		    s.measured |= domain_stats::readers_measured;
+		    s.readers = registered().load(memory_order_relaxed);
+		}
+		registry().collect(s);
+		return s;
+	    }
+	};
+    } // namespace detail
+} // namespace rcu
+} // namespace std
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "rcu_domain.hpp"
+
+// A thread pool whose workers are registered readers of a domain, so that
+// tasks may call read_lock() without registering themselves.  Meant for
+// rcu_domain_qsbr, where read_lock() costs nothing but every registered
+// thread must report quiescent states and go offline before it blocks, or
+// grace periods stall.  The pool does both for its workers: after every
+// quiescentTasks tasks, or after the first task to end quiescentMicroseconds
+// or more past the last report, it calls quiescent_state(), and it brackets
+// each wait for work with thread_offline() and thread_online().  Reporting
+// in batches rather than per task keeps the cost of quiescent_state(), a
+// store between two full fences, off most tasks.
+//
+// A task therefore must not keep a reference obtained under read_lock() for
+// a later task, nor block while inside a read-side critical section.  With
+// a domain whose quiescent_state_needed() is false, workers just register,
+// and tasks use the domain's read side as any thread would.  Tasks must not
+// throw.
+
+namespace std {
+namespace rcu {
+    template<class Domain>
+    class thread_pool {
+	Domain& d;
+	const long quiescentTasks;
+	const chrono::microseconds quiescentTime;
+	mutex m;
+	condition_variable work;	// Workers wait here for tasks
+	condition_variable idle;	// wait_idle() waits here
+	deque<function<void()>> tasks;
+	long unfinished = 0;		// Submitted and not yet run to the end
+	bool stopping = false;
+	vector<thread> workers;
+
+	void worker()
+	{
+	    d.register_thread();
+	    long sinceQuiescent = 0;
+	    chrono::steady_clock::time_point lastQuiescent = chrono::steady_clock::now();
+	    unique_lock<mutex> lock(m);
+	    while (true) {
+		if (tasks.empty()) {
+		    if (stopping) break;
+		    lock.unlock();
+		    if (d.quiescent_state_needed()) d.thread_offline();
+		    lock.lock();
+		    work.wait(lock, [this]{ return stopping || !tasks.empty(); });
+		    lock.unlock();
+		    if (d.quiescent_state_needed()) {
+			// Being offline was as good as a quiescent state
+			d.thread_online();
+			sinceQuiescent = 0;
+			lastQuiescent = chrono::steady_clock::now();
+		    }
+		    lock.lock();
+		    continue;
+		}
+		function<void()> task = std::move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+		task();
+		if (d.quiescent_state_needed()) {
+		    const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		    if (++sinceQuiescent >= quiescentTasks || now - lastQuiescent >= quiescentTime) {
+			d.quiescent_state();
+			sinceQuiescent = 0;
+			lastQuiescent = now;
+		    }
+		}
+		lock.lock();
+		if (--unfinished == 0) idle.notify_all();
+	    }
+	    lock.unlock();
+	    d.unregister_thread();
+	}
+
+    public:
+	// Starts nthreads workers, registered with d
+	thread_pool(Domain& d, const int nthreads, const long quiescentTasks = 64,
+		    const long quiescentMicroseconds = 1000)
+	    : d(d), quiescentTasks(quiescentTasks < 1 ? 1 : quiescentTasks),
+	      quiescentTime(quiescentMicroseconds < 0 ? 0 : quiescentMicroseconds)
+	{
+	    for (int t = 0; t < nthreads; t++) workers.emplace_back(&thread_pool::worker, this);
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	// Runs the tasks still queued, then stops the workers
+	~thread_pool()
+	{
+	    {
+		lock_guard<mutex> lock(m);
+		stopping = true;
+		work.notify_all();
+	    }
+	    for (thread& t : workers) t.join();
+	}
+
+	void submit(function<void()> task)
+	{
+	    lock_guard<mutex> lock(m);
+	    tasks.push_back(std::move(task));
+	    unfinished++;
+	    work.notify_one();
+	}
+
+	// Waits until every task submitted so far has run
+	void wait_idle()
+	{
+	    unique_lock<mutex> lock(m);
+	    idle.wait(lock, [this]{ return unfinished == 0; });
+	}
+    };
+} // namespace rcu
+} // namespace std
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+
+// Static tracepoints for perf, bpftrace and SystemTap, under the provider
+// "rcu", to correlate latency with reclamation on a running binary:
+//
+//   retire(object, deleter type name, grace-period sequence, bytes)
+//	rcu_obj_base::retire() and rcu_retire()
+//   callback(object, deleter type name)
+//	their trampolines, as the deleter is about to run
+//   gp_start(sequence, slot), gp_end(sequence, slot)
+//	rcu_domain_rv::synchronize_tid(); slot is the caller's, or -1
+//   cell_update(cell, new value, value type name)
+//	rcu::cell::update()
+//
+// The sequence is the domain's gp_sequence(), or 0 for a domain without
+// one, and type names are those of typeid().  Each probe is a nop until a
+// tracer attaches, and its arguments are plain loads.  They are built in
+// wherever <sys/sdt.h> (systemtap-sdt-dev) is found, unless RCU_NO_PROBES
+// is defined; RCU_PROBES_ENABLED tells which.  For example:
+//
+//   bpftrace -e 'usdt:./prog:rcu:retire { @[str(arg1)] = count(); }'
+
+#if !defined(RCU_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define RCU_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef RCU_PROBES_ENABLED
+#define RCU_PROBE2(name, a1, a2) STAP_PROBE2(rcu, name, a1, a2)
+#define RCU_PROBE3(name, a1, a2, a3) STAP_PROBE3(rcu, name, a1, a2, a3)
+#define RCU_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(rcu, name, a1, a2, a3, a4)
+#else
+#define RCU_PROBE2(name, a1, a2) ((void)0)
+#define RCU_PROBE3(name, a1, a2, a3) ((void)0)
+#define RCU_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
+
+namespace std {
+namespace rcu {
+    namespace detail {
+	// The domain's gp_sequence() for the probes, or 0 if it has none
+	template<class Domain>
+	auto probe_sequence(Domain& d, int) noexcept -> decltype(uint64_t(d.gp_sequence()))
+	{
+	    return d.gp_sequence();
+	}
+
+	template<class Domain>
+	uint64_t probe_sequence(Domain&, long) noexcept
+	{
+	    return 0;
+	}
+    } // namespace detail
+} // namespace rcu
+} // namespace std
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include "urcu-rv.hpp"
+
+// Nested read-side critical sections in rcu_domain_rv, for both normal and
+// expedited grace periods, the per-node summaries of numa_tree mode, plus
+// the cost of an inner (nested) section compared with a flat one.
+
+rcu_domain_rv rv;
+
+void test_nested_section_blocks_grace_period(const bool expedited)
+{
+	std::atomic<bool> done(false);
+
+	rv.register_thread();
+	rv.read_lock();
+	rv.read_lock();
+	rv.read_unlock();	// Must not end the outer section
+
+	std::thread updater([&done, expedited]() {
+		if (expedited)
+			rv.synchronize_expedited();
+		else
+			rv.synchronize();
+		done = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	assert(!done);
+
+	rv.read_unlock();
+	updater.join();
+	assert(done);
+	rv.unregister_thread();
+}
+
+struct obj {
+	std::atomic<int> alive;
+};
+
+// A node found quiet, and its summary reset, must not hide a reader that
+// comes in afterwards; readers coming and going never see a retired object.
+void test_numa_tree_summary(const rcu_domain_rv::read_side side)
+{
+	rcu_domain_rv d(32, 1, rcu_domain_rv::wait_policy::park, side,
+			rcu_domain_rv::reader_tracking::numa_tree);
+	std::atomic<int> state(0);
+
+	std::thread reader([&]() {
+		d.register_thread();
+		d.read_lock();
+		d.read_unlock();
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::yield();
+		d.read_lock();
+		state = 3;
+		while (state.load() != 4)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		d.read_unlock();
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+	d.synchronize();	// Finds the node quiet
+	d.synchronize();
+	state = 2;
+	while (state.load() != 3)
+		std::this_thread::yield();
+	std::atomic<bool> done(false);
+	std::thread updater([&]() {
+		d.synchronize();
+		done = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	assert(!done);
+	state = 4;
+	updater.join();
+	reader.join();
+
+	std::atomic<obj *> shared(new obj{{1}});
+	std::vector<obj *> retired;
+	std::atomic<bool> stop(false);
+	std::atomic<long> bad(0);
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++) {
+		readers.emplace_back([&]() {
+			d.register_thread();
+			while (!stop.load()) {
+				d.read_lock();
+				if (shared.load()->alive.load() != 1)
+					bad++;
+				d.read_unlock();
+			}
+			d.unregister_thread();
+		});
+	}
+	for (int i = 0; i < 2000; i++) {
+		obj *old = shared.exchange(new obj{{1}});
+		d.synchronize();
+		old->alive = 0;
+		retired.push_back(old);
+	}
+	stop = true;
+	for (auto& t : readers)
+		t.join();
+	assert(bad == 0);
+	for (obj *o : retired)
+		delete o;
+	delete shared.load();
+	std::cout << "numa_tree summary, " << (side == rcu_domain_rv::read_side::fenced ? "fenced" : "membarrier")
+		  << ": OK\n";
+}
+
+template<class F>
+double ns_per_op(long n, F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < n; i++)
+		f();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+void bench_nested_vs_flat()
+{
+	const long n = 10000000;
+
+	rv.register_thread();
+	double flat = ns_per_op(n, []() {
+		rv.read_lock();
+		rv.read_unlock();
+	});
+	rv.read_lock();
+	double nested = ns_per_op(n, []() {
+		rv.read_lock();
+		rv.read_unlock();
+	});
+	rv.read_unlock();
+	rv.unregister_thread();
+
+	std::cout << "flat read_lock()/read_unlock():   " << flat << " ns\n";
+	std::cout << "nested read_lock()/read_unlock(): " << nested << " ns\n";
+}
+
+int main()
+{
+	test_nested_section_blocks_grace_period(false);
+	test_nested_section_blocks_grace_period(true);
+	test_numa_tree_summary(rcu_domain_rv::read_side::fenced);
+	test_numa_tree_summary(rcu_domain_rv::read_side::membarrier);
+	bench_nested_vs_flat();
+	return 0;
+}
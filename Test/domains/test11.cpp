@@ -0,0 +1,96 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-rv.hpp"
+
+// Several rcu_domain_rv instances used from the same threads: each
+// registration is independent, and a long reader in one domain does not
+// hold up grace periods in another.
+
+struct foo {
+	int a;
+};
+
+foo my_foo;
+
+void my_func(rcu_head *)
+{
+	std::cout << "Hello World from a callback!\n";
+}
+
+static rcu_domain_rv _rv1;
+static rcu_domain_rv _rv2;
+static std::rcu::rcu_domain_wrapper<rcu_domain_rv> _rv1w(_rv1);
+static std::rcu::rcu_domain_wrapper<rcu_domain_rv> _rv2w(_rv2);
+std::rcu::rcu_domain_base& rv1 = _rv1w;
+std::rcu::rcu_domain_base& rv2 = _rv2w;
+
+void synchronize_rcu_abstract(std::rcu::rcu_domain_base& p, std::string s)
+{
+	std::cout << s << "\n";
+	p.register_thread();
+	p.read_lock();
+	p.read_unlock();
+	p.quiescent_state();
+	p.synchronize();
+	p.cond_synchronize(p.get_state());
+	p.retire(reinterpret_cast<rcu_head *>(&my_foo), my_func);
+	p.barrier();
+	p.unregister_thread();
+}
+
+// Both registrations at once, with interleaved (not nested) sections.
+void test_interleaved_sections()
+{
+	rv1.register_thread();
+	rv2.register_thread();
+	rv1.read_lock();
+	rv2.read_lock();
+	rv1.read_unlock();	// Must leave rv2's section alone
+	std::thread updater([]() { rv1.synchronize(); });
+	updater.join();
+	rv2.read_unlock();
+	rv2.unregister_thread();
+	rv1.unregister_thread();
+}
+
+// A reader stuck in rv1 blocks rv1's grace periods but not rv2's.
+void test_independent_grace_periods()
+{
+	std::atomic<int> state(0);
+	std::thread reader([&state]() {
+		rv1.register_thread();
+		rv2.register_thread();
+		rv1.read_lock();
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		rv1.read_unlock();
+		rv2.unregister_thread();
+		rv1.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	rv2.synchronize();
+	auto cookie = rv1.get_state();
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	assert(!rv1.poll_state(cookie));
+
+	state = 2;
+	rv1.cond_synchronize(cookie);
+	assert(rv1.poll_state(cookie));
+	reader.join();
+}
+
+int main()
+{
+	synchronize_rcu_abstract(rv1, "First rcu_domain_rv instance");
+	synchronize_rcu_abstract(rv2, "Second rcu_domain_rv instance");
+	test_interleaved_sections();
+	test_independent_grace_periods();
+	return 0;
+}
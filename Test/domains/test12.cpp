@@ -0,0 +1,106 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "urcu-rseq.hpp"
+
+// Callback budget and the urgent lane of rcu_domain_rv: a mass retire is
+// invoked a budget at a time, barrier() still waits for all of it, and an
+// urgent callback does not wait behind the backlog, nor lets barrier()
+// return before it.  The barrier() of rcu_domain_srcu and rcu_domain_rseq
+// must hold out the same way.
+
+// rcu_domain_rv never looks inside an rcu_head, which it leaves incomplete.
+struct counted {
+	int seq;
+};
+
+std::atomic<long> invoked(0);
+std::atomic<long> invoked_before_urgent(-1);
+
+void count_func(rcu_head *rhp)
+{
+	invoked++;
+	delete reinterpret_cast<counted *>(rhp);
+	// Slow callbacks, so that the backlog lasts a while
+	std::this_thread::sleep_for(std::chrono::microseconds(20));
+}
+
+void urgent_func(rcu_head *rhp)
+{
+	invoked_before_urgent = invoked.load();
+	delete reinterpret_cast<counted *>(rhp);
+}
+
+rcu_domain_rv rv;
+
+void test_budget_and_barrier()
+{
+	const long n = 2000;
+
+	rv.set_callback_budget(16, 0);
+	for (long i = 0; i < n; i++)
+		rv.retire(reinterpret_cast<rcu_head *>(new counted{ (int)i }), count_func);
+	rv.barrier();
+	assert(invoked == n);
+}
+
+void test_urgent_lane()
+{
+	const long n = 20000;
+
+	invoked = 0;
+	rv.set_callback_budget(16, 100);
+	for (long i = 0; i < n; i++)
+		rv.retire(reinterpret_cast<rcu_head *>(new counted{ (int)i }), count_func);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	rv.retire_urgent(reinterpret_cast<rcu_head *>(new counted{ -1 }), urgent_func);
+	rv.barrier();
+	assert(invoked == n);
+	std::cout << "urgent callback ran after " << invoked_before_urgent
+		  << " of " << n << " backlogged callbacks\n";
+	assert(invoked_before_urgent < n);
+	rv.set_callback_budget(0, 0);
+}
+
+template<class Domain>
+void test_barrier_under_urgent_stream(Domain& d, const char *name)
+{
+	const long n = 200;
+	std::atomic<bool> stop(false);
+
+	invoked = 0;
+	d.set_callback_budget(1, 0);
+	for (long i = 0; i < n; i++)
+		d.retire(reinterpret_cast<rcu_head *>(new counted{ (int)i }), count_func);
+	std::thread urgent([&]() {
+		while (!stop.load())
+			d.retire_urgent(reinterpret_cast<rcu_head *>(new counted{ -1 }), urgent_func);
+	});
+	d.barrier();
+	assert(invoked == n);
+	stop = true;
+	urgent.join();
+	d.barrier();
+	d.set_callback_budget(0, 0);
+	std::cout << name << " barrier under urgent callbacks: OK\n";
+}
+
+int main()
+{
+	test_budget_and_barrier();
+	test_urgent_lane();
+	test_barrier_under_urgent_stream(rv, "rcu_domain_rv");
+	{
+		rcu_domain_srcu srcu;
+		test_barrier_under_urgent_stream(srcu, "rcu_domain_srcu");
+	}
+	{
+		rcu_domain_rseq rseq;
+		test_barrier_under_urgent_stream(rseq, "rcu_domain_rseq");
+	}
+	return 0;
+}
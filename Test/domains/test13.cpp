@@ -0,0 +1,77 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-srcu.hpp"
+#include "rcu_guard.hpp"
+
+// rcu_domain_srcu: a read-side section begun on one thread and ended on
+// another, as happens to a coroutine resumed on a different thread, still
+// holds up grace periods until it ends.
+
+struct foo {
+	int a;
+};
+
+rcu_domain_srcu srcu;
+std::atomic<int> callbacks(0);
+
+void my_func(rcu_head *rhp)
+{
+	callbacks++;
+	delete reinterpret_cast<foo *>(rhp);
+}
+
+void test_section_handed_between_threads()
+{
+	std::atomic<bool> done(false);
+	rcu_domain_srcu::token t = srcu.read_lock();
+
+	std::thread updater([&done]() {
+		srcu.synchronize();
+		done = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	assert(!done);
+
+	// Sleeping readers are fine, and so is ending the section elsewhere
+	std::thread other([t]() { srcu.read_unlock(t); });
+	other.join();
+	updater.join();
+	assert(done);
+}
+
+void test_retire_waits_for_reader()
+{
+	rcu_domain_srcu::token t = srcu.read_lock();
+	srcu.retire(reinterpret_cast<rcu_head *>(new foo{ 42 }), my_func);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	assert(callbacks == 0);
+	srcu.read_unlock(t);
+	srcu.barrier();
+	assert(callbacks == 1);
+}
+
+void test_guard_and_wrapper()
+{
+	std::rcu::rcu_domain_wrapper<rcu_domain_srcu> w(srcu);
+	std::rcu::rcu_domain_base& rb = w;
+
+	{
+		rcu_guard<rcu_domain_srcu> g(srcu);
+		rb.read_lock();
+		rb.read_unlock();
+	}
+	rb.synchronize();
+	assert(rb.poll_state(rb.get_state() - 1));
+}
+
+int main()
+{
+	test_section_handed_between_threads();
+	test_retire_waits_for_reader();
+	test_guard_and_wrapper();
+	std::cout << "rcu_domain_srcu tests passed\n";
+	return 0;
+}
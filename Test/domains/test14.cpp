@@ -0,0 +1,79 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-signal.hpp"
+#include "urcu-hp.hpp"
+#include "rcu.hpp"
+
+// rcu_domain_hp: the same rcu_obj_base type retired through RCU or hazard
+// pointers by the domain argument alone, and a protected object outliving
+// the scans that free everything around it.
+
+std::atomic<int> destroyed(0);
+
+struct foo: public std::rcu_obj_base<foo> {
+	int a;
+	foo(int a) : a(a) {}
+	~foo() { destroyed++; }
+};
+
+rcu_domain_signal rs;
+rcu_domain_hp hp;
+
+void test_same_type_either_domain()
+{
+	(new foo(1))->retire(rs);
+	rs.barrier();
+	assert(destroyed == 1);
+	(new foo(2))->retire(hp);
+	hp.barrier();
+	assert(destroyed == 2);
+}
+
+void test_protected_object_survives_scans()
+{
+	std::atomic<foo *> shared(new foo(42));
+	std::atomic<int> state(0);
+
+	std::thread reader([&]() {
+		hp.register_thread();
+		hp.read_lock();
+		foo *p = hp.protect(shared);
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		assert(p->a == 42);
+		hp.read_unlock();
+		hp.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	// Enough retires for several scans, all but the first one unprotected
+	const int n = 1000;
+	destroyed = 0;
+	shared.exchange(new foo(43))->retire(hp);
+	for (int i = 0; i < n; i++)
+		(new foo(i))->retire(hp);
+	assert(destroyed >= n / 2 && destroyed <= n);
+
+	state = 2;
+	hp.barrier();
+	assert(destroyed == n + 1);
+	reader.join();
+	delete shared.load();
+}
+
+int main()
+{
+	rcu_register_thread();
+	hp.register_thread();
+	test_same_type_either_domain();
+	test_protected_object_survives_scans();
+	hp.unregister_thread();
+	rcu_unregister_thread();
+	std::cout << "rcu_domain_hp tests passed\n";
+	return 0;
+}
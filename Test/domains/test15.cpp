@@ -0,0 +1,98 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include "urcu-rseq.hpp"
+
+// rcu_domain_rseq, with the rseq counters where available and with the
+// atomic fallback: readers need no registration, a reader holds up grace
+// periods, and many concurrent readers keep the counters balanced.
+
+struct foo {
+	int a;
+};
+
+std::atomic<int> callbacks(0);
+
+void my_func(rcu_head *rhp)
+{
+	callbacks++;
+	delete reinterpret_cast<foo *>(rhp);
+}
+
+const char *name(rcu_domain_rseq::read_side rs)
+{
+	switch (rs) {
+	case rcu_domain_rseq::read_side::rseq_membarrier: return "rseq + membarrier";
+	case rcu_domain_rseq::read_side::rseq_fenced: return "rseq + fences";
+	default: return "atomic counters";
+	}
+}
+
+void test_reader_blocks_grace_period(rcu_domain_rseq& d)
+{
+	std::atomic<bool> done(false);
+	rcu_domain_rseq::token t = d.read_lock();
+
+	std::thread updater([&d, &done]() {
+		d.synchronize();
+		done = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	assert(!done);
+	d.read_unlock(t);
+	updater.join();
+	assert(done);
+}
+
+void test_many_readers(rcu_domain_rseq& d)
+{
+	std::atomic<foo *> shared(new foo{ 0 });
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> readers;
+
+	callbacks = 0;
+	for (int i = 0; i < 64; i++) {
+		readers.emplace_back([&]() {
+			while (!stop) {
+				rcu_domain_rseq::token t = d.read_lock();
+				assert(shared.load()->a >= 0);
+				d.read_unlock(t);
+			}
+		});
+	}
+	for (int i = 1; i <= 1000; i++)
+		d.retire(reinterpret_cast<rcu_head *>(shared.exchange(new foo{ i })), my_func);
+	stop = true;
+	for (auto& t : readers)
+		t.join();
+	d.barrier();
+	assert(callbacks == 1000);
+	delete shared.load();
+}
+
+template<class F>
+double ns_per_op(long n, F f)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < n; i++)
+		f();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+int main()
+{
+	for (bool useRseq : { true, false }) {
+		rcu_domain_rseq d(useRseq);
+
+		test_reader_blocks_grace_period(d);
+		test_many_readers(d);
+		double ns = ns_per_op(10000000, [&d]() { d.read_unlock(d.read_lock()); });
+		std::cout << name(d.effective_read_side())
+			  << " read_lock()/read_unlock(): " << ns << " ns\n";
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#define RCU_HEADER_ONLY 1
+#include "rcu.hpp"
+
+// paulmck/rcu.hpp without liburcu: rcu_reader, rcu_obj_base::retire(),
+// rcu_retire(), synchronize_rcu() and rcu_barrier() on the header-only
+// default domain, from threads that never register.  Built without -lurcu.
+
+std::atomic<int> destroyed(0);
+
+struct foo: public std::rcu_obj_base<foo> {
+	int a;
+	foo(int a) : a(a) {}
+	~foo() { destroyed++; }
+};
+
+struct bar {
+	int a;
+	~bar() { destroyed++; }
+};
+
+void test_retire_and_barrier()
+{
+	destroyed = 0;
+	(new foo(1))->retire();
+	std::rcu_retire(new bar{2});
+	std::rcu_barrier();
+	assert(destroyed == 2);
+}
+
+void test_reader_holds_off_synchronize()
+{
+	std::atomic<int> state(0);
+	std::atomic<bool> synchronized(false);
+
+	std::thread reader([&]() {
+		std::rcu_reader rr;
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		assert(!synchronized.load());
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+	std::thread updater([&]() {
+		std::synchronize_rcu();
+		synchronized = true;
+	});
+	state = 2;
+	reader.join();
+	updater.join();
+	assert(synchronized.load());
+}
+
+void test_concurrent_readers_and_updaters()
+{
+	std::atomic<foo *> shared(new foo(0));
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> threads;
+
+	destroyed = 0;
+	for (int t = 0; t < 4; t++) {
+		threads.emplace_back([&]() {
+			while (!stop.load()) {
+				std::rcu_reader rr;
+				foo *p = shared.load(std::memory_order_acquire);
+				assert(p->a >= 0);
+			}
+		});
+	}
+	const int n = 10000;
+	for (int i = 1; i <= n; i++)
+		shared.exchange(new foo(i))->retire();
+	stop = true;
+	for (auto& t : threads)
+		t.join();
+	std::rcu_barrier();
+	assert(destroyed == n);
+	delete shared.load();
+}
+
+void retire_from_second_unit();	// test16b.cpp
+
+int main()
+{
+	std::cout << "read side: "
+		  << (std::rcu_global_domain::domain().effective_read_side() ==
+		      rcu_domain_rv::read_side::membarrier ? "membarrier" : "fenced") << "\n";
+	test_retire_and_barrier();
+	test_reader_holds_off_synchronize();
+	test_concurrent_readers_and_updaters();
+	destroyed = 0;
+	retire_from_second_unit();
+	assert(destroyed == 1);
+	std::cout << "OK\n";
+	return 0;
+}
@@ -0,0 +1,22 @@
+#include <atomic>
+#define RCU_HEADER_ONLY 1
+#include "rcu.hpp"
+
+// A second translation unit for test16: the header-only default domain must
+// link when included from more than one file, and both files must see the
+// same domain.
+
+extern std::atomic<int> destroyed;
+
+struct baz: public std::rcu_obj_base<baz> {
+	~baz() { destroyed++; }
+};
+
+void retire_from_second_unit()
+{
+	{
+		std::rcu_reader rr;
+	}
+	(new baz)->retire();
+	std::rcu_barrier();
+}
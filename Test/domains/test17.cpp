@@ -0,0 +1,136 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "urcu-ebr.hpp"
+#include "urcu-hp.hpp"
+#include "urcu-rseq.hpp"
+
+// try_synchronize(), synchronize_for() and synchronize_until() on the
+// pure-C++ domains: they time out while a reader holds the grace period
+// up, a retry with the same cookie completes once the reader is gone, and
+// rcu_domain_rv names the slot it was waiting for.
+
+using std::chrono::milliseconds;
+
+struct foo {
+	int a;
+};
+
+// Runs hold(d, state) on a thread of its own, which sets state to 1 once
+// inside its read-side critical section and stays there until state is 2
+template<class Domain, class Hold>
+void test_blocked_then_resumed(Domain& d, const char *name, Hold hold)
+{
+	std::atomic<int> state(0);
+
+	std::thread reader([&]() {
+		d.register_thread();
+		hold(d, state);
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	const std::rcu::gp_state cookie = d.get_state();
+	assert(!d.try_synchronize(cookie));
+	assert(!std::rcu::synchronize_for(d, cookie, milliseconds(20)));
+	const auto start = std::chrono::steady_clock::now();
+	assert(!d.synchronize_until(cookie, start + milliseconds(20)));
+	assert(std::chrono::steady_clock::now() - start < milliseconds(500));
+	assert(!d.poll_state(cookie));
+
+	state = 2;
+	reader.join();
+	assert(std::rcu::synchronize_for(d, cookie, std::chrono::seconds(10)));
+	assert(d.poll_state(cookie));
+	assert(d.try_synchronize(cookie));
+	std::cout << name << ": OK\n";
+}
+
+template<class Domain>
+void hold_section(Domain& d, std::atomic<int>& state)
+{
+	auto t = std::rcu::read_lock(d);
+	state = 1;
+	while (state.load() != 2)
+		std::this_thread::sleep_for(milliseconds(1));
+	std::rcu::read_unlock(d, t);
+}
+
+void test_rv_reports_blocking_slot()
+{
+	rcu_domain_rv d;
+	std::atomic<int> state(0);
+	std::atomic<int> slot(-1);
+
+	std::thread reader([&]() {
+		d.register_thread();
+		slot = d.reader_slot();
+		d.read_lock();
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(milliseconds(1));
+		d.read_unlock();
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+	const std::rcu::gp_state cookie = d.get_state();
+	int blocking = -1;
+	assert(!d.try_synchronize(cookie, &blocking));
+	assert(blocking == slot.load());
+	blocking = -1;
+	assert(!d.synchronize_until(cookie, std::chrono::steady_clock::now() + milliseconds(20), &blocking));
+	assert(blocking == slot.load());
+	state = 2;
+	reader.join();
+	assert(d.try_synchronize(cookie) || std::rcu::synchronize_for(d, cookie, std::chrono::seconds(10)));
+	std::cout << "rcu_domain_rv blocking slot: OK\n";
+}
+
+int main()
+{
+	{
+		rcu_domain_rv d;
+		test_blocked_then_resumed(d, "rcu_domain_rv", hold_section<rcu_domain_rv>);
+	}
+	{
+		rcu_domain_rv d(32, 1, rcu_domain_rv::wait_policy::park, rcu_domain_rv::read_side::fenced,
+				rcu_domain_rv::reader_tracking::numa_tree);
+		test_blocked_then_resumed(d, "rcu_domain_rv numa_tree", hold_section<rcu_domain_rv>);
+	}
+	{
+		rcu_domain_srcu d;
+		test_blocked_then_resumed(d, "rcu_domain_srcu", hold_section<rcu_domain_srcu>);
+	}
+	{
+		rcu_domain_ebr d;
+		test_blocked_then_resumed(d, "rcu_domain_ebr", hold_section<rcu_domain_ebr>);
+	}
+	{
+		rcu_domain_rseq d;
+		test_blocked_then_resumed(d, "rcu_domain_rseq", hold_section<rcu_domain_rseq>);
+	}
+	{
+		// Hazard pointers only wait for readers that protect something
+		rcu_domain_hp d;
+		foo f{1};
+		std::atomic<foo *> shared(&f);
+		test_blocked_then_resumed(d, "rcu_domain_hp",
+			[&shared](rcu_domain_hp& d, std::atomic<int>& state) {
+				d.read_lock();
+				foo *p = d.protect(shared, [](foo *q) { return reinterpret_cast<rcu_head *>(q); });
+				state = 1;
+				while (state.load() != 2)
+					std::this_thread::sleep_for(milliseconds(1));
+				assert(p->a == 1);
+				d.read_unlock();
+			});
+	}
+	test_rv_reports_blocking_slot();
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <coroutine>
+#include <cassert>
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "urcu-ebr.hpp"
+#include "urcu-hp.hpp"
+#include "rcu_async.hpp"
+
+// synchronize_async() and barrier_async(): the future and the awaitable
+// complete once the grace period (or every earlier callback) is done,
+// without the updater blocking in between, also on domains that only invoke
+// callbacks from later retire() calls.  Built as C++20.
+
+using std::chrono::milliseconds;
+
+std::atomic<int> freed(0);
+
+struct foo {
+	int a;
+};
+
+void free_foo(rcu_head *rhp)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(50));
+	delete reinterpret_cast<foo *>(rhp);
+	freed++;
+}
+
+// Just enough of a coroutine type to start one and let it run to the end
+struct task {
+	struct promise_type {
+		task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+template<class Domain>
+task free_after_grace_period(Domain& d, foo *old, std::atomic<int>& step)
+{
+	step = 1;
+	co_await std::rcu::synchronize_async(d);
+	delete old;
+	step = 2;
+}
+
+template<class Domain>
+task wait_for_barrier(Domain& d, std::atomic<int>& step)
+{
+	co_await std::rcu::barrier_async(d);
+	step = 3;
+}
+
+template<class Domain>
+void test_future_waits_for_reader(Domain& d, const char *name)
+{
+	std::atomic<int> state(0);
+	std::thread reader([&]() {
+		d.register_thread();
+		auto t = std::rcu::read_lock(d);
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(milliseconds(1));
+		std::rcu::read_unlock(d, t);
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	std::future<void> f = std::rcu::synchronize_async(d).get_future();
+	assert(f.wait_for(milliseconds(50)) == std::future_status::timeout);
+	state = 2;
+	reader.join();
+	f.get();
+	std::cout << name << " future: OK\n";
+}
+
+// With no later retire() to invoke a marker, the wait must still complete
+template<class Domain>
+void test_nothing_else_retired(Domain& d, const char *name)
+{
+	for (int i = 0; i < 3; i++)
+		std::rcu::synchronize_async(d).get_future().get();
+	std::cout << name << " nothing else retired: OK\n";
+}
+
+template<class Domain>
+void test_coroutines(Domain& d, const char *name)
+{
+	std::atomic<int> step(0);
+	free_after_grace_period(d, new foo{1}, step);
+	assert(step.load() >= 1);	// Suspended, or already done
+	while (step.load() != 2)
+		std::this_thread::sleep_for(milliseconds(1));
+
+	freed = 0;
+	const int n = 100;
+	for (int i = 0; i < n; i++)
+		d.retire(reinterpret_cast<rcu_head *>(new foo{i}), free_foo);
+	wait_for_barrier(d, step);
+	while (step.load() != 3)
+		std::this_thread::sleep_for(milliseconds(1));
+	assert(freed == n);
+	std::cout << name << " co_await: OK\n";
+}
+
+int main()
+{
+	rcu_domain_rv rv;
+	rcu_domain_srcu srcu;
+	rcu_domain_ebr ebr;
+	rcu_domain_hp hp;
+	std::rcu::rcu_domain_wrapper<rcu_domain_rv> rvw(rv);
+	std::rcu::rcu_domain_base& rb = rvw;
+
+	test_future_waits_for_reader(rv, "rcu_domain_rv");
+	test_future_waits_for_reader(srcu, "rcu_domain_srcu");
+	test_future_waits_for_reader(ebr, "rcu_domain_ebr");
+	test_nothing_else_retired(ebr, "rcu_domain_ebr");
+	test_nothing_else_retired(hp, "rcu_domain_hp");
+	test_coroutines(rv, "rcu_domain_rv");
+	test_coroutines(srcu, "rcu_domain_srcu");
+	ebr.register_thread();
+	hp.register_thread();
+	test_coroutines(ebr, "rcu_domain_ebr");
+	test_coroutines(hp, "rcu_domain_hp");
+	ebr.unregister_thread();
+	hp.unregister_thread();
+	test_coroutines(rb, "rcu_domain_base");
+
+	// A barrier covers everything retired before it, from any thread
+	freed = 0;
+	std::thread other([&]() {
+		rv.register_thread();
+		for (int i = 0; i < 100; i++)
+			rv.retire(reinterpret_cast<rcu_head *>(new foo{i}), free_foo);
+		rv.unregister_thread();
+	});
+	other.join();
+	std::rcu::barrier_async(rv).get_future().get();
+	assert(freed == 100);
+	std::cout << "barrier_async: OK\n";
+	return 0;
+}
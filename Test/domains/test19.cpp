@@ -0,0 +1,169 @@
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "urcu-ebr.hpp"
+#include "urcu-hp.hpp"
+#include "urcu-rseq.hpp"
+#include "rcu_executor.hpp"
+
+// set_callback_executor() on the pure-C++ domains: a user executor sees
+// every capture() come back in execute(), urgent callbacks bypass it, and
+// thread_return_executor runs each callback on the thread that retired it,
+// either from run_pending() or when that thread exits.
+
+const int N = 200;
+
+std::atomic<int> freed(0);
+std::atomic<int> misplaced(0);
+
+struct foo {
+	std::thread::id owner;
+};
+
+void free_foo(rcu_head *rhp)
+{
+	foo *p = reinterpret_cast<foo *>(rhp);
+	if (p->owner != std::this_thread::get_id())
+		misplaced++;
+	delete p;
+	freed++;
+}
+
+void free_anywhere(rcu_head *rhp)
+{
+	delete reinterpret_cast<foo *>(rhp);
+	freed++;
+}
+
+rcu_head *new_foo()
+{
+	return reinterpret_cast<rcu_head *>(new foo{std::this_thread::get_id()});
+}
+
+struct counting_executor : public std::rcu::callback_executor {
+	std::atomic<int> captured{0};
+	std::atomic<int> executed{0};
+	std::atomic<int> foreign{0};	// Contexts this executor did not hand out
+
+	void *capture() noexcept override
+	{
+		captured++;
+		return this;
+	}
+	void execute(void *context, rcu_head *rhp, void (*cbf)(rcu_head *rhp)) noexcept override
+	{
+		if (context != this)
+			foreign++;
+		executed++;
+		cbf(rhp);
+	}
+};
+
+template<class Domain>
+void test_user_executor(Domain& d, const char *name)
+{
+	counting_executor ex;
+
+	freed = 0;
+	d.set_callback_executor(&ex);
+	for (int i = 0; i < N; i++)
+		d.retire(new_foo(), free_anywhere);
+	d.retire_urgent(new_foo(), free_anywhere);
+	d.barrier();
+	d.set_callback_executor(nullptr);
+	d.retire(new_foo(), free_anywhere);
+	d.barrier();
+	assert(freed == N + 2);
+	assert(ex.captured == N);
+	assert(ex.executed == N);
+	assert(ex.foreign == 0);
+	std::cout << name << " user executor: OK\n";
+}
+
+template<class Domain>
+void test_thread_return(Domain& d, const char *name)
+{
+	std::rcu::thread_return_executor ex;
+
+	freed = 0;
+	misplaced = 0;
+	d.set_callback_executor(&ex);
+	std::thread t([&]() {
+		d.register_thread();
+		for (int i = 0; i < N; i++)
+			d.retire(new_foo(), free_foo);
+		d.barrier();
+		assert(freed == 0);
+		assert(ex.run_pending() == (size_t)N);
+		assert(ex.run_pending() == 0);
+		d.unregister_thread();
+	});
+	t.join();
+	assert(freed == N);
+
+	// An exiting thread runs what it has queued
+	freed = 0;
+	std::thread u([&]() {
+		d.register_thread();
+		for (int i = 0; i < N; i++)
+			d.retire(new_foo(), free_foo);
+		d.barrier();
+		d.unregister_thread();
+	});
+	u.join();
+	assert(freed == N);
+	assert(misplaced == 0);
+
+	// u's queue is free now, so its late callbacks run on the domain's side
+	std::thread v([&]() {
+		d.register_thread();
+		for (int i = 0; i < N; i++)
+			d.retire(new_foo(), free_anywhere);
+		d.unregister_thread();
+	});
+	v.join();
+	d.barrier();
+	assert(freed == 2 * N);
+	d.set_callback_executor(nullptr);
+	std::cout << name << " thread_return_executor: OK\n";
+}
+
+template<class Domain>
+void test_domain(Domain& d, const char *name)
+{
+	test_user_executor(d, name);
+	test_thread_return(d, name);
+}
+
+int main()
+{
+	{
+		rcu_domain_rv d;
+		test_domain(d, "rcu_domain_rv");
+	}
+	{
+		rcu_domain_srcu d;
+		test_domain(d, "rcu_domain_srcu");
+	}
+	{
+		rcu_domain_ebr d;
+		test_domain(d, "rcu_domain_ebr");
+	}
+	{
+		rcu_domain_hp d;
+		test_domain(d, "rcu_domain_hp");
+	}
+	{
+		rcu_domain_rseq d;
+		test_domain(d, "rcu_domain_rseq");
+	}
+	{
+		rcu_domain_rv d;
+		std::rcu::rcu_domain_wrapper<rcu_domain_rv> w(d);
+		test_user_executor<std::rcu::rcu_domain_base>(w, "rcu_domain_base");
+	}
+	return 0;
+}
@@ -0,0 +1,246 @@
+#define RCU_HEADER_ONLY 1
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cassert>
+#include "rcu.hpp"
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+#include "urcu-ebr.hpp"
+#include "urcu-hp.hpp"
+#include "urcu-rseq.hpp"
+
+// set_reclaim_budget(): retire() counts the bytes pending reclamation, and
+// while a reader holds the grace period up, a retire() past the hard limit
+// either reclaims the object itself once the reader is gone or waits for
+// the backlog to drain; one inside a read-side critical section queues
+// the object instead.  rcu_obj_base and rcu_retire() report their sizes
+// to the default domain.  Concurrent retirers never overshoot the hard
+// limit, and an object reclaimed inline still goes through the executor.
+// Destroying rcu_domain_ebr invokes whatever is
+// still pending, however recent.
+
+using std::chrono::milliseconds;
+
+const size_t SIZE = 1000;
+const int LIMIT = 4;			// Objects that fit under the hard limit
+
+std::atomic<int> freed(0);
+std::atomic<int> freedByUpdater(0);	// On the thread that went over the limit
+thread_local bool isUpdater = false;
+
+struct foo {
+	std::thread::id owner;
+};
+
+void free_foo(rcu_head *rhp)
+{
+	delete reinterpret_cast<foo *>(rhp);
+	if (isUpdater)
+		freedByUpdater++;
+	freed++;
+}
+
+rcu_head *new_foo()
+{
+	return reinterpret_cast<rcu_head *>(new foo{std::this_thread::get_id()});
+}
+
+// Runs each callback on the spot, counting them
+struct counting_executor : std::rcu::callback_executor {
+	std::atomic<int> executed{0};
+
+	void execute(void *, rcu_head *rhp, void (*cbf)(rcu_head *rhp)) noexcept override
+	{
+		executed++;
+		cbf(rhp);
+	}
+};
+
+void test_concurrent_admit()
+{
+	const int THREADS = 8;
+	std::rcu::detail::reclaim_budget budget;
+	std::atomic<int> admitted(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+
+	budget.set(0, LIMIT * SIZE, std::rcu::over_hard_limit::reclaim_inline);
+	for (int t = 0; t < THREADS; t++) {
+		threads.emplace_back([&]() {
+			while (!go.load())
+				std::this_thread::yield();
+			for (int i = 0; i < LIMIT; i++) {
+				size_t charged;
+				if (budget.admit(SIZE, charged, false))
+					admitted++;
+			}
+		});
+	}
+	go = true;
+	for (std::thread& t : threads)
+		t.join();
+	assert(admitted == LIMIT);
+	assert(budget.pending_bytes() == LIMIT * SIZE);
+	std::cout << "concurrent admit: OK\n";
+}
+
+template<class Domain>
+void test_over_hard_limit(Domain& d, const char *name, std::rcu::over_hard_limit policy)
+{
+	std::atomic<int> state(0);
+	std::atomic<bool> retired(false);
+
+	counting_executor ex;
+	freed = 0;
+	freedByUpdater = 0;
+	d.set_callback_executor(&ex);
+	d.set_reclaim_budget(0, LIMIT * SIZE, policy);
+	std::thread reader([&]() {
+		d.register_thread();
+		auto t = std::rcu::read_lock(d);
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(milliseconds(1));
+		std::rcu::read_unlock(d, t);
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	for (int i = 0; i < LIMIT; i++)
+		d.retire(new_foo(), free_foo, SIZE);
+	assert(d.pending_bytes() == LIMIT * SIZE);
+	std::thread updater([&]() {
+		isUpdater = true;
+		d.retire(new_foo(), free_foo, SIZE);
+		retired = true;
+	});
+	std::this_thread::sleep_for(milliseconds(50));
+	assert(!retired);
+	assert(freed == 0);
+
+	state = 2;
+	reader.join();
+	updater.join();
+	d.barrier();
+	assert(freed == LIMIT + 1);
+	assert(d.pending_bytes() == 0);
+	if (policy == std::rcu::over_hard_limit::reclaim_inline)
+		assert(freedByUpdater == 1);	// Its own object, after a grace period
+	assert(ex.executed == LIMIT + 1);
+	d.set_callback_executor(nullptr);
+	d.set_reclaim_budget(0, 0);
+	std::cout << name << (policy == std::rcu::over_hard_limit::block ? " block" : " reclaim_inline") << ": OK\n";
+}
+
+// Past the soft limit retire() just carries on, and the count drains
+template<class Domain>
+void test_soft_limit(Domain& d, const char *name)
+{
+	freed = 0;
+	d.set_reclaim_budget(2 * SIZE, 0);
+	d.set_callback_budget(1, 0);
+	for (int i = 0; i < 100; i++)
+		d.retire(new_foo(), free_foo, SIZE);
+	d.barrier();
+	assert(freed == 100);
+	assert(d.pending_bytes() == 0);
+	d.set_callback_budget(0, 0);
+	d.set_reclaim_budget(0, 0);
+	std::cout << name << " soft limit: OK\n";
+}
+
+// Inside a read-side critical section a retire() past the hard limit can
+// neither wait for a grace period nor reclaim, so it queues the object
+template<class Domain>
+void test_retire_in_section(Domain& d, const char *name)
+{
+	freed = 0;
+	d.set_reclaim_budget(0, SIZE);
+	d.register_thread();
+	auto t = std::rcu::read_lock(d);
+	d.retire(new_foo(), free_foo, SIZE);
+	d.retire(new_foo(), free_foo, SIZE);
+	assert(freed == 0);
+	assert(d.pending_bytes() == 2 * SIZE);
+	std::rcu::read_unlock(d, t);
+	d.barrier();
+	assert(freed == 2);
+	assert(d.pending_bytes() == 0);
+	d.unregister_thread();
+	d.set_reclaim_budget(0, 0);
+	std::cout << name << " retire in section: OK\n";
+}
+
+template<class Domain>
+void test_domain(Domain& d, const char *name, bool canBlock)
+{
+	test_soft_limit(d, name);
+	test_retire_in_section(d, name);
+	test_over_hard_limit(d, name, std::rcu::over_hard_limit::reclaim_inline);
+	if (canBlock)
+		test_over_hard_limit(d, name, std::rcu::over_hard_limit::block);
+}
+
+void test_ebr_destructor()
+{
+	freed = 0;
+	{
+		rcu_domain_ebr d;
+		d.register_thread();
+		for (int i = 0; i < 10; i++)
+			d.retire(new_foo(), free_foo);
+		d.unregister_thread();
+		d.retire(new_foo(), free_foo);	// Straight to the orphans
+		assert(freed < 11);
+	}
+	assert(freed == 11);
+	std::cout << "rcu_domain_ebr destructor: OK\n";
+}
+
+struct bar : std::rcu_obj_base<bar> {
+	char payload[SIZE];
+};
+
+int main()
+{
+	test_concurrent_admit();
+	{
+		rcu_domain_rv d;
+		test_domain(d, "rcu_domain_rv", true);
+	}
+	{
+		rcu_domain_srcu d;
+		test_domain(d, "rcu_domain_srcu", true);
+	}
+	{
+		rcu_domain_rseq d;
+		test_domain(d, "rcu_domain_rseq", true);
+	}
+	{
+		rcu_domain_ebr d;
+		test_domain(d, "rcu_domain_ebr", false);
+	}
+	test_ebr_destructor();
+	{
+		// Hazard pointers do not wait for plain readers; just the counting
+		rcu_domain_hp d;
+		test_soft_limit(d, "rcu_domain_hp");
+	}
+
+	std::rcu_global_domain g;
+	g.set_reclaim_budget(0, 100 * SIZE);
+	g.read_lock();		// Holds the callbacks back
+	(new bar)->retire();
+	std::rcu_retire(new foo{std::this_thread::get_id()});
+	assert(g.pending_bytes() >= sizeof(bar) + sizeof(foo));
+	g.read_unlock();
+	std::rcu_barrier();
+	assert(g.pending_bytes() == 0);
+	g.set_reclaim_budget(0, 0);
+	std::cout << "rcu_global_domain: OK\n";
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "urcu-rv.hpp"
+#include "urcu-srcu.hpp"
+
+// stats(): rcu_domain_rv counts callbacks pending and freed, grace periods
+// with their latency, the longest reader a grace period waited for and the
+// registered readers, through rcu_domain_base as well; write_stats() dumps
+// that for a metrics scraper.  A domain without stats() reports nothing.
+
+using std::chrono::milliseconds;
+
+const int N = 100;
+const size_t SIZE = 64;
+const int HOLD_MS = 20;
+
+std::atomic<int> freed(0);
+
+void free_foo(rcu_head *rhp)
+{
+	delete[] reinterpret_cast<char *>(rhp);
+	freed++;
+}
+
+rcu_head *new_foo()
+{
+	return reinterpret_cast<rcu_head *>(new char[SIZE]);
+}
+
+void test_rv(std::rcu::rcu_domain_base& d)
+{
+	std::atomic<int> state(0);
+	std::rcu::domain_stats s = d.stats();
+
+	assert(s.measured & std::rcu::domain_stats::callbacks_measured);
+	assert(s.readers == 0);
+	const uint64_t gracePeriods = s.grace_periods;
+
+	std::thread reader([&]() {
+		d.register_thread();
+		d.read_lock();
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(milliseconds(1));
+		d.read_unlock();
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+	assert(d.stats().readers == 1);
+
+	// The reader holds these back
+	freed = 0;
+	for (int i = 0; i < N; i++)
+		d.retire(new_foo(), free_foo, SIZE);
+	std::this_thread::sleep_for(milliseconds(HOLD_MS));
+	s = d.stats();
+	assert(freed == 0);
+	assert(s.pending_callbacks == (uint64_t)N);
+	assert(s.pending_bytes == N * SIZE);
+
+	state = 2;
+	reader.join();
+	d.barrier();
+	s = d.stats();
+	assert(freed == N);
+	assert(s.pending_callbacks == 0);
+	assert(s.pending_bytes == 0);
+	assert(s.readers == 0);
+	assert(s.retire_to_free.total() == (uint64_t)N);
+	assert(s.grace_periods > gracePeriods);
+	assert(s.grace_period_latency.total() >= s.grace_periods - gracePeriods);
+	assert(s.max_read_section_us >= HOLD_MS * 1000);
+
+	// Every callback waited at least as long as the reader was held up
+	uint64_t early = 0;
+	for (int i = 0; std::rcu::latency_histogram::bucket(HOLD_MS * 1000000ull) > i + 1; i++)
+		early += s.retire_to_free.counts[i];
+	assert(early == 0);
+	assert(s.retire_to_free.sum_ns >= N * HOLD_MS * 1000000ull);
+
+	std::ostringstream out;
+	std::rcu::write_stats(out, s, "rv");
+	const std::string text = out.str();
+	assert(text.find("rcu_pending_callbacks{domain=\"rv\"} 0\n") != std::string::npos);
+	assert(text.find("rcu_retire_to_free_us_count{domain=\"rv\"} " + std::to_string(N) + "\n") != std::string::npos);
+	assert(text.find("rcu_retire_to_free_us_sum{domain=\"rv\"} " +
+			 std::to_string(s.retire_to_free.sum_ns / 1000) + "\n") != std::string::npos);
+	assert(text.find("rcu_grace_period_latency_us_bucket{domain=\"rv\",le=\"+Inf\"}") != std::string::npos);
+	assert(text.find("rcu_readers{domain=\"rv\"} 0\n") != std::string::npos);
+	std::cout << text;
+}
+
+int main()
+{
+	{
+		rcu_domain_rv d;
+		std::rcu::rcu_domain_wrapper<rcu_domain_rv> w(d);
+		test_rv(w);
+		std::cout << "rcu_domain_rv: OK\n";
+	}
+	{
+		rcu_domain_srcu d;
+		std::rcu::rcu_domain_wrapper<rcu_domain_srcu> w(d);
+		std::ostringstream out;
+		assert(w.stats().measured == 0);
+		std::rcu::write_stats(out, w.stats(), "srcu");
+		assert(out.str().empty());
+		std::cout << "rcu_domain_srcu: OK\n";
+	}
+	return 0;
+}
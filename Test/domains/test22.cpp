@@ -0,0 +1,85 @@
+#define RCU_HEADER_ONLY 1
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <elf.h>
+#include "rcu.hpp"
+#include "rcu_cell.hpp"
+#include "urcu-rv.hpp"
+
+// The USDT probes of rcu_trace.hpp: runs each probed path once, then lists
+// the probes built into this binary from its .note.stapsdt section, as
+// "perf list sdt_rcu:*" or "bpftrace -l 'usdt:./test22:rcu:*'" would.
+// Without <sys/sdt.h> there are none, and the list must be empty.
+
+struct foo : std::rcu_obj_base<foo> {
+	int a = 1;
+};
+
+// provider:name of every probe in the ELF file at path
+std::vector<std::string> list_probes(const char *path)
+{
+	std::ifstream in(path, std::ios::binary);
+	const std::vector<char> image((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::vector<std::string> probes;
+	assert(image.size() > sizeof(Elf64_Ehdr));
+
+	Elf64_Ehdr eh;
+	memcpy(&eh, image.data(), sizeof(eh));
+	assert(memcmp(eh.e_ident, ELFMAG, SELFMAG) == 0 && eh.e_ident[EI_CLASS] == ELFCLASS64);
+	std::vector<Elf64_Shdr> sections(eh.e_shnum);
+	memcpy(sections.data(), image.data() + eh.e_shoff, eh.e_shnum * sizeof(Elf64_Shdr));
+	const char *names = image.data() + sections[eh.e_shstrndx].sh_offset;
+
+	for (const Elf64_Shdr& sh : sections) {
+		if (sh.sh_type != SHT_NOTE || strcmp(names + sh.sh_name, ".note.stapsdt") != 0)
+			continue;
+		for (size_t off = sh.sh_offset; off < sh.sh_offset + sh.sh_size; ) {
+			Elf64_Nhdr nh;
+			memcpy(&nh, image.data() + off, sizeof(nh));
+			const char *desc = image.data() + off + sizeof(nh) + ((nh.n_namesz + 3) & ~3u);
+			// The probe, its link-time base and its semaphore, then the strings
+			const char *provider = desc + 3 * sizeof(Elf64_Addr);
+			const char *name = provider + strlen(provider) + 1;
+			probes.push_back(std::string(provider) + ":" + name);
+			off += sizeof(nh) + ((nh.n_namesz + 3) & ~3u) + ((nh.n_descsz + 3) & ~3u);
+		}
+	}
+	return probes;
+}
+
+int main()
+{
+	rcu_domain_rv d;
+
+	(new foo)->retire();
+	(new foo)->retire(d);
+	std::rcu_retire(new int(1));
+	std::rcu::cell<int> c(std::unique_ptr<int>(new int(1)));
+	c.update(std::unique_ptr<int>(new int(2)));
+	c.update(nullptr);
+	d.synchronize();
+	d.barrier();
+	std::rcu_barrier();
+
+	std::set<std::string> found;
+	for (const std::string& probe : list_probes("/proc/self/exe")) {
+		std::cout << probe << "\n";
+		found.insert(probe);
+	}
+#ifdef RCU_PROBES_ENABLED
+	for (const char *probe : { "rcu:retire", "rcu:callback", "rcu:gp_start", "rcu:gp_end", "rcu:cell_update" })
+		assert(found.count(probe) == 1);
+	std::cout << "Probes: OK\n";
+#else
+	assert(found.empty());
+	std::cout << "Probes: none, <sys/sdt.h> not found\n";
+#endif
+	return 0;
+}
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cassert>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "urcu-rv.hpp"
+
+// rcu_domain_rv's stall watchdog: a reader that holds up a grace period for
+// longer than the threshold is reported with its slot, its OS thread id and
+// the time so far, once per threshold; a long reader that no grace period
+// waits for is not.
+
+using std::chrono::milliseconds;
+
+const milliseconds THRESHOLD(20);
+const milliseconds CHECK_EVERY(2);
+
+struct report {
+	int slot;
+	long osTid;
+	std::chrono::microseconds stalled;
+};
+
+std::mutex reportsMutex;
+std::vector<report> reports;
+
+void on_stall(int slot, long osTid, std::chrono::microseconds stalled)
+{
+	std::lock_guard<std::mutex> lock(reportsMutex);
+	reports.push_back(report{slot, osTid, stalled});
+}
+
+size_t report_count()
+{
+	std::lock_guard<std::mutex> lock(reportsMutex);
+	return reports.size();
+}
+
+int main()
+{
+	rcu_domain_rv d;
+	std::atomic<int> state(0);
+	std::atomic<int> readerSlot(-1);
+	std::atomic<long> readerTid(0);
+
+	d.start_stall_watchdog(THRESHOLD, on_stall, CHECK_EVERY);
+	std::thread reader([&]() {
+		d.register_thread();
+		readerSlot = d.reader_slot();
+		readerTid = syscall(SYS_gettid);
+		d.read_lock();
+		state = 1;
+		while (state.load() != 2)
+			std::this_thread::sleep_for(milliseconds(1));
+		d.read_unlock();
+		d.unregister_thread();
+	});
+	while (state.load() != 1)
+		std::this_thread::yield();
+
+	// Nothing waits for the reader yet
+	std::this_thread::sleep_for(THRESHOLD * 3);
+	assert(report_count() == 0);
+
+	std::atomic<bool> synchronized(false);
+	std::thread updater([&]() {
+		d.synchronize();
+		synchronized = true;
+	});
+	std::this_thread::sleep_for(THRESHOLD * 5 / 2);
+	assert(!synchronized);
+	state = 2;
+	reader.join();
+	updater.join();
+
+	{
+		std::lock_guard<std::mutex> lock(reportsMutex);
+		assert(reports.size() >= 1 && reports.size() <= 3);
+		for (size_t i = 0; i < reports.size(); i++) {
+			assert(reports[i].slot == readerSlot);
+			assert(reports[i].osTid == readerTid);
+			assert(reports[i].stalled >= THRESHOLD * (i + 1));
+			std::cout << "slot " << reports[i].slot << " thread " << reports[i].osTid << " stalled "
+				  << reports[i].stalled.count() << " us\n";
+		}
+	}
+
+	// Grace periods with no reader in the way report nothing
+	const size_t before = report_count();
+	for (int i = 0; i < 10; i++)
+		d.synchronize();
+	std::this_thread::sleep_for(THRESHOLD * 2);
+	assert(report_count() == before);
+	d.stop_stall_watchdog();
+	std::cout << "Stall watchdog: OK\n";
+	return 0;
+}
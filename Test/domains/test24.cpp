@@ -0,0 +1,138 @@
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cassert>
+#include "rcu_thread_pool.hpp"
+#include "urcu-rv.hpp"
+
+// rcu::thread_pool: every worker is registered while it runs tasks, reports
+// a quiescent state every N tasks or T microseconds rather than per task,
+// and is offline whenever it waits for work.  A QSBR-like domain that only
+// counts stands in for rcu_domain_qsbr; rcu_domain_rv shows the pool with a
+// domain that needs none of it.
+
+const int WORKERS = 4;
+const long EVERY_TASKS = 16;
+
+// Counts what the pool does, and checks that read-side sections only happen
+// registered and online
+class counting_domain {
+	static thread_local bool registered;
+	static thread_local bool online;
+public:
+	std::atomic<int> registrations{0};
+	std::atomic<int> unregistrations{0};
+	std::atomic<long> quiescentStates{0};
+	std::atomic<long> offlines{0};
+	std::atomic<long> onlines{0};
+	std::atomic<long> readSections{0};
+	std::atomic<long> badSections{0};
+
+	static constexpr bool register_thread_needed() { return true; }
+	void register_thread() { registered = online = true; registrations++; }
+	void unregister_thread() { registered = false; unregistrations++; }
+	void thread_offline() noexcept { assert(online); online = false; offlines++; }
+	void thread_online() noexcept { assert(!online); online = true; onlines++; }
+
+	static constexpr bool quiescent_state_needed() { return true; }
+	void quiescent_state() noexcept { quiescentStates++; }
+
+	void read_lock() noexcept
+	{
+		if (!registered || !online)
+			badSections++;
+		readSections++;
+	}
+	void read_unlock() noexcept {}
+};
+
+thread_local bool counting_domain::registered = false;
+thread_local bool counting_domain::online = false;
+
+void test_quiescent_every_n()
+{
+	counting_domain d;
+	const long tasks = 10000;
+	{
+		// A time limit that never runs out, so only the count matters
+		std::rcu::thread_pool<counting_domain> pool(d, WORKERS, EVERY_TASKS, 100000000);
+		for (long i = 0; i < tasks; i++)
+			pool.submit([&d]() { d.read_lock(); d.read_unlock(); });
+		pool.wait_idle();
+		assert(d.readSections == tasks);
+		assert(d.badSections == 0);
+		assert(d.quiescentStates <= tasks / EVERY_TASKS);
+		assert(d.quiescentStates >= tasks / EVERY_TASKS - WORKERS * (d.offlines + 1));
+		assert(d.registrations == WORKERS);
+	}
+	assert(d.unregistrations == WORKERS);
+	assert(d.offlines == d.onlines + WORKERS || d.offlines == d.onlines);
+	std::cout << "quiescent every " << EVERY_TASKS << " tasks: " << d.quiescentStates << " for " << tasks
+		  << " tasks, " << d.offlines << " offline waits: OK\n";
+}
+
+void test_quiescent_every_t()
+{
+	counting_domain d;
+	{
+		std::rcu::thread_pool<counting_domain> pool(d, 1, 1000000, 1000);
+		for (int i = 0; i < 20; i++)
+			pool.submit([]() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); });
+		pool.wait_idle();
+		// Every task outlasts the time limit
+		assert(d.quiescentStates == 20);
+	}
+	std::cout << "quiescent every 1000 us: OK\n";
+}
+
+void test_offline_while_idle()
+{
+	counting_domain d;
+	{
+		std::rcu::thread_pool<counting_domain> pool(d, WORKERS);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		assert(d.offlines == WORKERS);	// All waiting
+		assert(d.onlines == 0);
+		pool.submit([]() {});
+		pool.wait_idle();
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		assert(d.onlines >= 1);
+		assert(d.offlines == d.onlines + WORKERS);
+	}
+	std::cout << "offline while idle: OK\n";
+}
+
+void test_rv()
+{
+	rcu_domain_rv d;
+	std::atomic<int *> shared(new int(0));
+	std::atomic<long> sum(0);
+	{
+		std::rcu::thread_pool<rcu_domain_rv> pool(d, WORKERS);
+		for (int i = 1; i <= 1000; i++) {
+			pool.submit([&]() {
+				d.read_lock();
+				sum += *shared.load();
+				d.read_unlock();
+			});
+			if (i % 100 == 0) {
+				int *old = shared.exchange(new int(i));
+				d.synchronize();
+				delete old;
+			}
+		}
+		pool.wait_idle();
+	}
+	delete shared.load();
+	std::cout << "rcu_domain_rv: OK\n";
+}
+
+int main()
+{
+	test_quiescent_every_n();
+	test_quiescent_every_t();
+	test_offline_while_idle();
+	test_rv();
+	return 0;
+}
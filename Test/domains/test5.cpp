@@ -1,5 +1,7 @@
 #include <iostream>
 #include <string>
+#include <chrono>
+#include <cassert>
 #include <unistd.h>
 #include <urcu.h>
 #include "rcu_domain.hpp"
@@ -24,8 +26,19 @@ void synchronize_rcu_abstract(std::rcu::rcu_domain_base& p, std::string s)
 	p.read_unlock();
 	p.quiescent_state();
 	p.synchronize();
+	p.synchronize_expedited();
+	p.cond_synchronize(p.get_state());
+	std::rcu::gp_state cookie = p.get_state();
+	if (!p.try_synchronize(cookie)) {
+		const bool completed = std::rcu::synchronize_for(p, cookie, std::chrono::seconds(10));
+		assert(completed);
+		(void)completed;
+	}
+	assert(p.poll_state(cookie));
 	p.retire(&my_foo.rh, my_func);
 	p.barrier();
+	p.retire_urgent(&my_foo.rh, my_func);
+	p.barrier();
 	p.unregister_thread();
 }
 
@@ -34,6 +47,10 @@ extern std::rcu::rcu_domain_base& rm;
 extern std::rcu::rcu_domain_base& rq;
 extern std::rcu::rcu_domain_base& rs;
 extern std::rcu::rcu_domain_base& rv;
+extern std::rcu::rcu_domain_base& rc;
+extern std::rcu::rcu_domain_base& re;
+extern std::rcu::rcu_domain_base& rh;
+extern std::rcu::rcu_domain_base& rr;
 
 int main()
 {
@@ -51,4 +68,8 @@ int main()
 	synchronize_rcu_abstract(rq, "Derived class rcu_qsbr");
 	synchronize_rcu_abstract(rs, "Derived class rcu_signal");
 	synchronize_rcu_abstract(rv, "Derived class rcu_rv");
+	synchronize_rcu_abstract(rc, "Derived class rcu_srcu");
+	synchronize_rcu_abstract(re, "Derived class rcu_ebr");
+	synchronize_rcu_abstract(rh, "Derived class rcu_hp");
+	synchronize_rcu_abstract(rr, "Derived class rcu_rseq");
 }
@@ -0,0 +1,5 @@
+#include "urcu-srcu.hpp"
+
+static rcu_domain_srcu _rc;
+static std::rcu::rcu_domain_wrapper<decltype(_rc)> _rcw(_rc);
+std::rcu::rcu_domain_base& rc = _rcw;
@@ -0,0 +1,5 @@
+#include "urcu-ebr.hpp"
+
+static rcu_domain_ebr _re;
+static std::rcu::rcu_domain_wrapper<decltype(_re)> _rew(_re);
+std::rcu::rcu_domain_base& re = _rew;
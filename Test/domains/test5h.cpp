@@ -0,0 +1,5 @@
+#include "urcu-hp.hpp"
+
+static rcu_domain_hp _rh;
+static std::rcu::rcu_domain_wrapper<decltype(_rh)> _rhw(_rh);
+std::rcu::rcu_domain_base& rh = _rhw;
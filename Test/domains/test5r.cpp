@@ -0,0 +1,5 @@
+#include "urcu-rseq.hpp"
+
+static rcu_domain_rseq _rr;
+static std::rcu::rcu_domain_wrapper<decltype(_rr)> _rrw(_rr);
+std::rcu::rcu_domain_base& rr = _rrw;
@@ -6,6 +6,8 @@
 
 class rcu_domain_bp {
 public:
+    // Every instance reads and waits on the flavor's process-wide state
+    static constexpr bool process_wide() { return true; }
     static constexpr bool register_thread_needed() { return false; }
     void register_thread() {}
     void unregister_thread() {}
@@ -18,8 +20,63 @@ public:
     void read_lock() noexcept { rcu_read_lock(); }
     void read_unlock() noexcept { rcu_read_unlock(); }
 
-    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) { call_rcu(rhp, cbf); }
+    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t bytes = 0)
+    {
+        callbacks.retire(rhp, cbf, bytes, true);
+    }
+    void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp)) { callbacks.retire_urgent(rhp, cbf); }
 
-    void synchronize() noexcept { synchronize_rcu(); }
+    // A call_rcu worker invokes its whole queue after each grace period
+    // and has no limit to set, so this is a no-op.
+    void set_callback_budget(long, long) noexcept {}
+
+    void set_callback_executor(std::rcu::callback_executor *ex) noexcept { callbacks.set_callback_executor(ex); }
+
+    // Replaces the default call_rcu worker with one per CPU, pinned there,
+    // for every thread of the process that has not picked a worker itself;
+    // each callback is queued on the worker of the CPU that retired it.
+    // Returns false where liburcu cannot tell the number of CPUs.
+    static bool use_per_cpu_call_rcu_data() noexcept { return create_all_cpu_call_rcu_data(0) == 0; }
+
+    void set_reclaim_budget(size_t softBytes, size_t hardBytes,
+                            std::rcu::over_hard_limit policy = std::rcu::over_hard_limit::reclaim_inline) noexcept
+    {
+        callbacks.set_reclaim_budget(softBytes, hardBytes, policy);
+    }
+    size_t pending_bytes() const noexcept { return callbacks.pending_bytes(); }
+
+    // Statistics for the flavor, shared by every rcu_domain_bp (see
+    // flavor_stats in rcu_stats.hpp).  Readers register with liburcu-bp on
+    // their own, so they are not counted, and callbacks are counted only
+    // after collect_stats(true), as that takes retire() a node allocation.
+    static std::rcu::domain_stats stats() { return stats_type::snapshot(false); }
+    static void collect_stats(bool on) noexcept { stats_type::collect().store(on, std::memory_order_relaxed); }
+
+    void synchronize() noexcept { callbacks_type::synchronize(); }
     void barrier() noexcept { rcu_barrier(); }
+
+    // Needs liburcu 0.13 or later
+    std::rcu::gp_state get_state() noexcept { return start_poll_synchronize_rcu().grace_period_id; }
+    bool poll_state(std::rcu::gp_state cookie) noexcept
+    {
+        urcu_gp_poll_state s;
+        s.grace_period_id = cookie;
+        return poll_state_synchronize_rcu(s);
+    }
+    void cond_synchronize(std::rcu::gp_state cookie) noexcept { if (!poll_state(cookie)) synchronize(); }
+
+    // get_state() has the call_rcu worker start the grace period, which then
+    // completes without us, so there is only its completion to poll for.
+    bool try_synchronize(std::rcu::gp_state cookie) noexcept { return poll_state(cookie); }
+    bool synchronize_until(std::rcu::gp_state cookie, std::rcu::gp_deadline deadline) noexcept
+    {
+        return std::rcu::detail::poll_until([this, cookie]{ return poll_state(cookie); }, deadline);
+    }
+
+private:
+    typedef std::rcu::detail::urcu_callbacks<rcu_domain_bp, rcu_head, call_rcu, synchronize_rcu, rcu_read_ongoing,
+                                             create_call_rcu_data, get_thread_call_rcu_data, set_thread_call_rcu_data> callbacks_type;
+    typedef callbacks_type::stats_type stats_type;
+
+    callbacks_type callbacks;
 };
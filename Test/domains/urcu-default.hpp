@@ -0,0 +1,151 @@
+#pragma once
+
+// The process-wide domain behind rcu_reader, rcu_obj_base::retire() without
+// a domain, rcu_retire(), synchronize_rcu() and rcu_barrier() in
+// paulmck/rcu.hpp and ajodwyer/rcu.hpp.
+//
+// Normally that is the global liburcu flavor selected by whichever RCU_*
+// macro was in effect when <urcu.h> was included, and every read-side
+// section is a call into the library.  Defining RCU_HEADER_ONLY, or
+// building where <urcu.h> cannot be found, selects a self-contained
+// domain instead, and no liburcu headers or libraries are needed: this
+// header then defines struct rcu_head itself.  That domain is a single
+// rcu_domain_rv with the membarrier read side (seq_cst where the kernel
+// lacks private expedited membarrier), so read_lock() and read_unlock()
+// inline to a few loads and stores; threads are registered on their
+// first read_lock() and release their slot when they exit, and callbacks
+// run on the domain's reclaimer thread.  The domain is never destroyed,
+// so threads may keep reading and retiring while the program exits.
+//
+// Either way, set_reclaim_budget() limits the bytes that rcu_obj_base,
+// rcu_retire() and rcu::cell leave pending reclamation, as for any domain
+// (see rcu_domain.hpp); with liburcu, the soft limit brings in an overflow
+// call_rcu worker, since its grace periods cannot be hurried.  stats()
+// reports on it too: everything rcu_domain_rv measures, or with liburcu
+// the grace periods waited for through synchronize(), and callbacks once
+// collect_stats(true) has been called.  Only the self-contained domain has
+// synchronize_expedited(); liburcu offers no expedited grace period.
+
+#include <cstddef>
+#include "rcu_domain.hpp"
+
+#if !defined(RCU_HEADER_ONLY) && defined(__has_include)
+#if !__has_include(<urcu.h>)
+#define RCU_HEADER_ONLY 1
+#endif
+#endif
+
+#ifdef RCU_HEADER_ONLY
+
+#include <new>
+#include "urcu-rv.hpp"
+
+// Same layout as liburcu's: a link and the callback
+extern "C" {
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+}
+
+namespace std {
+    class rcu_global_domain {
+    public:
+	static constexpr bool process_wide() { return true; }
+	void read_lock() noexcept { domain().read_lock(); }
+	void read_unlock() noexcept { domain().read_unlock(); }
+	void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t bytes = 0) { domain().retire(rhp, cbf, bytes); }
+	void synchronize() noexcept { domain().synchronize(); }
+	void synchronize_expedited() noexcept { domain().synchronize_expedited(); }
+	void barrier() noexcept { domain().barrier(); }
+
+	rcu::gp_state get_state() noexcept { return domain().get_state(); }
+	uint64_t gp_sequence() const noexcept { return domain().gp_sequence(); }
+	bool poll_state(rcu::gp_state cookie) noexcept { return domain().poll_state(cookie); }
+	bool try_synchronize(rcu::gp_state cookie) noexcept { return domain().try_synchronize(cookie); }
+	bool synchronize_until(rcu::gp_state cookie, rcu::gp_deadline deadline) noexcept
+	{
+	    return domain().synchronize_until(cookie, deadline);
+	}
+
+	void set_reclaim_budget(size_t soft_bytes, size_t hard_bytes,
+				rcu::over_hard_limit policy = rcu::over_hard_limit::reclaim_inline) noexcept
+	{
+	    domain().set_reclaim_budget(soft_bytes, hard_bytes, policy);
+	}
+	size_t pending_bytes() const noexcept { return domain().pending_bytes(); }
+	rcu::domain_stats stats() { return domain().stats(); }
+
+	// The underlying domain, for what the functions above do not cover
+	static rcu_domain_rv& domain()
+	{
+	    static rcu_domain_rv& d = make_domain();
+	    return d;
+	}
+
+    private:
+	static rcu_domain_rv& make_domain()
+	{
+	    alignas(rcu_domain_rv) static unsigned char storage[sizeof(rcu_domain_rv)];
+	    rcu_domain_rv *d = new (storage) rcu_domain_rv(32, 1, rcu_domain_rv::wait_policy::park,
+							   rcu_domain_rv::read_side::membarrier);
+	    d->set_auto_register(true);
+	    return *d;
+	}
+    };
+} // namespace std
+
+#else
+
+namespace std {
+    class rcu_global_domain {
+    public:
+	static constexpr bool process_wide() { return true; }
+	void read_lock() noexcept { ::rcu_read_lock(); }
+	void read_unlock() noexcept { ::rcu_read_unlock(); }
+	void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), size_t bytes = 0)
+	{
+	    callbacks().retire(rhp, cbf, bytes, true);
+	}
+	void synchronize() noexcept { callbacks_type::synchronize(); }
+	void barrier() noexcept { ::rcu_barrier(); }
+
+	// Needs liburcu 0.13 or later, as do the flavor wrappers
+	rcu::gp_state get_state() noexcept { return ::start_poll_synchronize_rcu().grace_period_id; }
+	bool poll_state(rcu::gp_state cookie) noexcept
+	{
+	    urcu_gp_poll_state s;
+	    s.grace_period_id = cookie;
+	    return ::poll_state_synchronize_rcu(s);
+	}
+	bool try_synchronize(rcu::gp_state cookie) noexcept { return poll_state(cookie); }
+	bool synchronize_until(rcu::gp_state cookie, rcu::gp_deadline deadline) noexcept
+	{
+	    return rcu::detail::poll_until([this, cookie]{ return poll_state(cookie); }, deadline);
+	}
+
+	void set_reclaim_budget(size_t soft_bytes, size_t hard_bytes,
+				rcu::over_hard_limit policy = rcu::over_hard_limit::reclaim_inline) noexcept
+	{
+	    callbacks().set_reclaim_budget(soft_bytes, hard_bytes, policy);
+	}
+	size_t pending_bytes() const noexcept { return callbacks().pending_bytes(); }
+	rcu::domain_stats stats() { return stats_type::snapshot(false); }
+	void collect_stats(bool on) noexcept { stats_type::collect().store(on, memory_order_relaxed); }
+
+    private:
+	typedef rcu::detail::urcu_callbacks<rcu_global_domain, rcu_head, ::call_rcu, ::synchronize_rcu,
+					    ::rcu_read_ongoing, ::create_call_rcu_data, ::get_thread_call_rcu_data,
+					    ::set_thread_call_rcu_data> callbacks_type;
+	typedef callbacks_type::stats_type stats_type;
+
+	// Process-wide, like the flavor; constant-initialized, so never torn down
+	static callbacks_type& callbacks() noexcept
+	{
+	    static callbacks_type c;
+	    return c;
+	}
+    };
+} // namespace std
+
+#endif
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "rcu_domain.hpp"
+
+/**
+ * Epoch-based reclamation (Fraser's EBR) with three epochs, using only the
+ * C++ memory model and atomics. There is no reclaimer thread: callbacks
+ * wait on per-thread limbo lists and are invoked by the thread that
+ * retired them, on one of its later retire() calls.
+ *
+ * The domain has a global epoch. The outermost read_lock() announces the
+ * global epoch in the thread's record together with an active bit, then
+ * issues a full fence; the outermost read_unlock() clears the record with a
+ * release store. try_advance() bumps the global epoch from E to E+1 only if
+ * every active record has announced E, so once the global epoch reaches
+ * E+2 every section that might have seen an object retired during E is over.
+ *
+ * Each record keeps three limbo lists, indexed by epoch modulo 3 and tagged
+ * with the epoch of their contents. retire() appends to the list of the
+ * current epoch (first moving that list's old contents, three epochs stale
+ * and so long safe, to the ready list), and every RETIRE_THRESHOLD retires
+ * tries to advance the epoch and invokes whatever has become safe. Records
+ * live on a lock-free list and are recycled, never freed before the domain.
+ *
+ * Each record's lists are guarded by a recursive mutex, uncontended except
+ * against barrier(), which invokes every thread's safe callbacks itself; a
+ * callback may retire further objects into the same domain.
+ *
+ * synchronize() spins, yields and then sleeps until the epoch has advanced
+ * twice. set_callback_budget() limits how many callbacks (and microseconds)
+ * a single retire() may spend on reclamation, leftovers staying on the
+ * ready list; retire_urgent() advances the epoch right away instead of
+ * waiting for the threshold. set_callback_executor() hands callbacks, once
+ * safe, to an executor instead of invoking them on the draining thread
+ * (urgent ones excepted). Past the soft limit of set_reclaim_budget(), every
+ * retire() advances the epoch and reclaims, regardless of the threshold and
+ * the budget. Callbacks retired by unregistered threads, or
+ * left behind by unregister_thread(), go to a shared orphan record that
+ * barrier() and the threshold reclamation of every thread drain.
+ *
+ * Limitations:
+ * - A thread that exits without calling unregister_thread() leaves its
+ *   record and its pending callbacks to barrier() and the domain destructor.
+ * - Callbacks must not call barrier().
+ */
+class rcu_domain_ebr {
+
+    static const uint64_t ACTIVE = 1;           // Low bit of ThreadRecord::state
+    static const int RETIRE_THRESHOLD = 64;     // Retires between reclamations
+    static const int SPIN_LIMIT = 1000;         // synchronize() attempts before yielding...
+    static const int YIELD_LIMIT = 100;         // ... and before sleeping
+
+    struct Callback {
+        rcu_head *rhp;
+        void (*cbf)(rcu_head *rhp);
+        std::rcu::callback_executor *executor;  // Null to invoke cbf directly
+        void *context;                          // From executor->capture()
+        size_t charged;                         // Against the reclaim budget
+
+        void invoke() const noexcept
+        {
+            if (executor == nullptr) cbf(rhp);
+            else executor->execute(context, rhp, cbf);
+        }
+    };
+
+    struct ThreadRecord {
+        std::atomic<uint64_t> state = { 0 };    // Announced epoch << 1 | ACTIVE
+        char pad0[128 - sizeof(std::atomic<uint64_t>)];
+        std::atomic<bool> inUse = { true };
+        ThreadRecord* next = nullptr;           // Registry list, immutable once linked
+        int nesting = 0;
+        int sinceReclaim = 0;
+        std::recursive_mutex limboMutex;        // Protects everything below
+        std::vector<Callback> limbo[3];
+        uint64_t limboEpoch[3] = { 0, 0, 0 };
+        std::vector<Callback> ready;            // Safe, not yet invoked
+    };
+
+    struct Registration {
+        uint64_t domainId;
+        ThreadRecord* rec;
+    };
+
+    const uint64_t domainId;
+    std::atomic<uint64_t> globalEpoch alignas(128) = { 0 };
+    std::atomic<ThreadRecord*> records alignas(128) = { nullptr };
+    ThreadRecord orphans;                       // Never active
+    std::atomic<long> budgetItems = { 0 };         // Per reclamation, 0 for no limit
+    std::atomic<long> budgetMicroseconds = { 0 };  // Per reclamation, 0 for no limit
+    std::atomic<std::rcu::callback_executor*> executor = { nullptr };
+    std::rcu::detail::reclaim_budget reclaimBudget;
+
+public:
+    rcu_domain_ebr() : domainId(next_domain_id()) {}
+
+    rcu_domain_ebr(const rcu_domain_ebr&) = delete;
+    rcu_domain_ebr& operator=(const rcu_domain_ebr&) = delete;
+
+    ~rcu_domain_ebr()
+    {
+        // No reader may be left, so every limbo list is safe now
+        drain_all(orphans);
+        ThreadRecord* rec = records.load();
+        while (rec != nullptr) {
+            ThreadRecord* next = rec->next;
+            drain_all(*rec);
+            delete rec;
+            rec = next;
+        }
+    }
+
+    static constexpr bool register_thread_needed() { return true; }
+
+    // Callbacks are only invoked from later retire() calls and barrier()
+    static constexpr bool callbacks_need_retire() { return true; }
+
+    void register_thread()
+    {
+        // Recycle a record left by an unregistered thread, or link a new one
+        ThreadRecord* rec = records.load();
+        for (; rec != nullptr; rec = rec->next) {
+            bool expected = false;
+            if (!rec->inUse.load() && rec->inUse.compare_exchange_strong(expected, true)) break;
+        }
+        if (rec == nullptr) {
+            rec = new ThreadRecord;
+            rec->next = records.load();
+            while (!records.compare_exchange_weak(rec->next, rec)) { }
+        }
+        rec->nesting = 0;
+        rec->sinceReclaim = 0;
+        registrations().push_back(Registration{domainId, rec});
+    }
+
+    void unregister_thread()
+    {
+        std::vector<Registration>& regs = registrations();
+        for (auto it = regs.begin(); it != regs.end(); ++it) {
+            if (it->domainId != domainId) continue;
+            ThreadRecord* rec = it->rec;
+            regs.erase(it);
+            rec->state.store(0, std::memory_order_release);
+            // Hand the pending callbacks over to the orphan record
+            {
+                std::lock_guard<std::recursive_mutex> lock(rec->limboMutex);
+                std::lock_guard<std::recursive_mutex> olock(orphans.limboMutex);
+                orphans.ready.insert(orphans.ready.end(), rec->ready.begin(), rec->ready.end());
+                rec->ready.clear();
+                for (int i = 0; i < 3; i++) {
+                    if (rec->limbo[i].empty()) continue;
+                    // Merged lists take the later tag, which only delays them
+                    if (orphans.limbo[i].empty() || orphans.limboEpoch[i] < rec->limboEpoch[i])
+                        orphans.limboEpoch[i] = rec->limboEpoch[i];
+                    orphans.limbo[i].insert(orphans.limbo[i].end(), rec->limbo[i].begin(), rec->limbo[i].end());
+                    rec->limbo[i].clear();
+                }
+            }
+            rec->inUse.store(false);
+            return;
+        }
+    }
+
+    void thread_offline() noexcept {}
+    void thread_online() noexcept {}
+
+    static constexpr bool quiescent_state_needed() { return false; }
+    void quiescent_state() noexcept {}
+
+    void read_lock() noexcept
+    {
+        ThreadRecord* const rec = my_record();
+        if (rec->nesting++ != 0) return;
+        rec->state.store(globalEpoch.load(std::memory_order_relaxed) << 1 | ACTIVE, std::memory_order_relaxed);
+        // Orders the announcement before the critical section; pairs with
+        // the fence in try_advance().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void read_unlock() noexcept
+    {
+        ThreadRecord* const rec = my_record();
+        if (--rec->nesting != 0) return;
+        rec->state.store(0, std::memory_order_release);
+    }
+
+    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), const size_t bytes = 0)
+    {
+        ThreadRecord* const rec = my_record();
+        size_t charged;
+        bool admitted = reclaimBudget.admit(bytes, charged, false);
+        if (!admitted && rec != nullptr && rec->nesting != 0) {
+            // Our own section would hold up the grace period
+            charged = reclaimBudget.charge(bytes);
+            admitted = true;
+        }
+        std::rcu::callback_executor* const ex = executor.load(std::memory_order_acquire);
+        const Callback cb{rhp, cbf, ex, (ex == nullptr) ? nullptr : ex->capture(), charged};
+        if (!admitted) {
+            // Over the hard limit: reclaim it here, executor and all
+            synchronize();
+            cb.invoke();
+            return;
+        }
+        ThreadRecord& target = (rec == nullptr) ? orphans : *rec;
+        {
+            std::lock_guard<std::recursive_mutex> lock(target.limboMutex);
+            add_to_limbo(target, globalEpoch.load(), cb);
+        }
+        // Past the soft limit every retire() reclaims, as fast as it can
+        const bool pressed = reclaimBudget.over_soft();
+        if (rec == nullptr || (++rec->sinceReclaim < RETIRE_THRESHOLD && !pressed)) return;
+        rec->sinceReclaim = 0;
+        if (try_advance() && pressed) try_advance();
+        drain(*rec, pressed);
+        // Orphaned callbacks have no thread of their own to invoke them
+        std::unique_lock<std::recursive_mutex> olock(orphans.limboMutex, std::try_to_lock);
+        if (olock.owns_lock()) drain(orphans, pressed);
+    }
+
+    void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp))
+    {
+        ThreadRecord* const rec = my_record();
+        ThreadRecord& target = (rec == nullptr) ? orphans : *rec;
+        std::lock_guard<std::recursive_mutex> lock(target.limboMutex);
+        add_to_limbo(target, globalEpoch.load(), Callback{rhp, cbf, nullptr, nullptr, 0});
+        // Two advances make it safe, unless some reader is holding the epoch
+        if (try_advance()) try_advance();
+        drain(target, false);
+    }
+
+    void set_callback_budget(const long maxItems, const long maxMicroseconds) noexcept
+    {
+        budgetItems.store(maxItems < 0 ? 0 : maxItems, std::memory_order_relaxed);
+        budgetMicroseconds.store(maxMicroseconds < 0 ? 0 : maxMicroseconds, std::memory_order_relaxed);
+    }
+
+    void set_callback_executor(std::rcu::callback_executor* const ex) noexcept
+    {
+        executor.store(ex, std::memory_order_release);
+    }
+
+    // Only retiring threads reclaim, so none may block waiting for it:
+    // past the hard limit retire() always reclaims inline.
+    void set_reclaim_budget(const size_t softBytes, const size_t hardBytes,
+                            const std::rcu::over_hard_limit policy = std::rcu::over_hard_limit::reclaim_inline) noexcept
+    {
+        reclaimBudget.set(softBytes, hardBytes, policy);
+    }
+    size_t pending_bytes() const noexcept { return reclaimBudget.pending_bytes(); }
+
+    void synchronize() noexcept { advance_to(globalEpoch.load() + 2, false); }
+
+    // Keeps trying to advance every microsecond or so once done spinning
+    void synchronize_expedited() noexcept { advance_to(globalEpoch.load() + 2, true); }
+
+    // The global epoch is all the state there is, so a retry carries on
+    // from wherever the last attempt left it.
+    bool try_synchronize(const std::rcu::gp_state cookie) noexcept
+    {
+        return advance_to(cookie, false, std::rcu::gp_deadline::min());
+    }
+    bool synchronize_until(const std::rcu::gp_state cookie, const std::rcu::gp_deadline deadline) noexcept
+    {
+        return advance_to(cookie, false, deadline);
+    }
+
+    std::rcu::gp_state get_state() noexcept { return globalEpoch.load() + 2; }
+    bool poll_state(const std::rcu::gp_state cookie) noexcept { return globalEpoch.load() >= cookie; }
+    void cond_synchronize(const std::rcu::gp_state cookie) noexcept
+    {
+        if (!poll_state(cookie)) synchronize();
+    }
+
+    // Invokes every callback retired before the call, whichever thread
+    // retired it.
+    void barrier() noexcept
+    {
+        synchronize();
+        for (ThreadRecord* rec = records.load(); rec != nullptr; rec = rec->next) {
+            std::lock_guard<std::recursive_mutex> lock(rec->limboMutex);
+            drain(*rec, true);
+        }
+        std::lock_guard<std::recursive_mutex> lock(orphans.limboMutex);
+        drain(orphans, true);
+    }
+
+private:
+    static uint64_t next_domain_id()
+    {
+        static std::atomic<uint64_t> lastId = { 0 };
+        return ++lastId;
+    }
+
+    static std::vector<Registration>& registrations()
+    {
+        static thread_local std::vector<Registration> regs;
+        return regs;
+    }
+
+    ThreadRecord* my_record() noexcept
+    {
+        for (const Registration& r : registrations()) {
+            if (r.domainId == domainId) return r.rec;
+        }
+        return nullptr;
+    }
+
+    // Caller holds rec.limboMutex
+    static void add_to_limbo(ThreadRecord& rec, const uint64_t epoch, const Callback& cb)
+    {
+        const int i = epoch % 3;
+        if (rec.limboEpoch[i] != epoch) {
+            // Left from three or more epochs ago
+            rec.ready.insert(rec.ready.end(), rec.limbo[i].begin(), rec.limbo[i].end());
+            rec.limbo[i].clear();
+            rec.limboEpoch[i] = epoch;
+        }
+        rec.limbo[i].push_back(cb);
+    }
+
+    // False if the deadline passed first
+    bool advance_to(const uint64_t target, const bool expedited,
+                    const std::rcu::gp_deadline deadline = std::rcu::gp_deadline::max()) noexcept
+    {
+        const bool timed = deadline != std::rcu::gp_deadline::max();
+        for (int i = 0; globalEpoch.load() < target; i++) {
+            if (try_advance()) continue;
+            if (timed && std::chrono::steady_clock::now() >= deadline) return false;
+            if (i < SPIN_LIMIT) continue;
+            if (expedited) std::this_thread::sleep_for(std::chrono::microseconds(1));
+            else if (i < SPIN_LIMIT + YIELD_LIMIT) std::this_thread::yield();
+            else if (timed) std::this_thread::sleep_until(std::min(deadline, std::chrono::steady_clock::now() +
+                                                                   std::chrono::microseconds(50)));
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        return true;
+    }
+
+    bool try_advance() noexcept
+    {
+        uint64_t e = globalEpoch.load();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (ThreadRecord* rec = records.load(); rec != nullptr; rec = rec->next) {
+            const uint64_t s = rec->state.load(std::memory_order_acquire);
+            if ((s & ACTIVE) && (s >> 1) != e) return false;
+        }
+        // Failing only means that another thread advanced it first
+        globalEpoch.compare_exchange_strong(e, e + 1);
+        return true;
+    }
+
+    // Moves the lists that are now safe to the ready list and invokes it,
+    // within the budget unless all is set.  Locks rec.limboMutex.
+    void drain(ThreadRecord& rec, const bool all)
+    {
+        std::lock_guard<std::recursive_mutex> lock(rec.limboMutex);
+        const uint64_t e = globalEpoch.load();
+        for (int i = 0; i < 3; i++) {
+            if (rec.limbo[i].empty() || rec.limboEpoch[i] + 2 > e) continue;
+            rec.ready.insert(rec.ready.end(), rec.limbo[i].begin(), rec.limbo[i].end());
+            rec.limbo[i].clear();
+        }
+        if (rec.ready.empty()) return;
+
+        // Callbacks may retire more objects into rec.ready, so work on a copy
+        std::vector<Callback> batch;
+        batch.swap(rec.ready);
+        const long maxItems = all ? 0 : budgetItems.load(std::memory_order_relaxed);
+        const long maxMicroseconds = all ? 0 : budgetMicroseconds.load(std::memory_order_relaxed);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t n = 0;
+        for (; n < batch.size(); n++) {
+            if (maxItems != 0 && n >= (size_t)maxItems) break;
+            if (maxMicroseconds != 0 && n != 0 &&
+                std::chrono::steady_clock::now() - start >= std::chrono::microseconds(maxMicroseconds)) break;
+            batch[n].invoke();
+            reclaimBudget.credit(batch[n].charged);
+        }
+        rec.ready.insert(rec.ready.begin(), batch.begin() + n, batch.end());
+    }
+
+    // Invokes everything rec holds, whatever its epoch, including what the
+    // callbacks themselves retire into it.  Only for the destructor.
+    void drain_all(ThreadRecord& rec)
+    {
+        std::lock_guard<std::recursive_mutex> lock(rec.limboMutex);
+        while (true) {
+            for (int i = 0; i < 3; i++) {
+                rec.ready.insert(rec.ready.end(), rec.limbo[i].begin(), rec.limbo[i].end());
+                rec.limbo[i].clear();
+            }
+            if (rec.ready.empty()) return;
+            drain(rec, true);
+        }
+    }
+};
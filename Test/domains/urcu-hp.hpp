@@ -0,0 +1,452 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "rcu_domain.hpp"
+
+/**
+ * Hazard pointers (Michael's algorithm) behind the same retire() entry point
+ * as the RCU domains, so that an object deriving from std::rcu_obj_base
+ * switches between RCU and hazard-pointer protection by the domain it is
+ * retired to. Unlike RCU, a stalled reader only holds back the objects it
+ * protects, so the garbage behind it stays bounded.
+ *
+ * Each registered thread has HAZARDS_PER_THREAD hazard slots. Readers bracket
+ * their accesses with read_lock()/read_unlock() as for any domain, and load
+ * every shared pointer they dereference through protect(), which publishes
+ * it in the next free slot, issues a full fence and re-reads the source
+ * until both agree. The outermost read_unlock() clears the thread's slots;
+ * read_lock() on its own protects nothing.
+ *
+ * protect() publishes the address that retire() will be handed for the
+ * object: rcu_head_of(p), found by argument-dependent lookup, for types
+ * deriving from std::rcu_obj_base. For other types the caller passes a
+ * function that maps p to that address; protect(src) does not compile.
+ *
+ * retire() appends to the calling thread's retired list. Once the list
+ * holds more than twice as many objects as there are hazard slots (and at
+ * least RETIRE_THRESHOLD), the thread scans: it collects every published
+ * hazard, sorts them, and invokes the callbacks of the objects that no
+ * hazard names, so each scan frees at least half of the list and retire()
+ * costs amortized O(1). set_callback_budget() caps the callbacks invoked per
+ * scan; retire_urgent() scans right away. set_callback_executor() hands the
+ * unprotected callbacks to an executor instead (urgent ones excepted). Past
+ * the soft limit of set_reclaim_budget(), every retire() scans, regardless
+ * of the threshold and the budget.
+ *
+ * synchronize() waits until every protection that existed when it was
+ * called has been dropped: for each thread with a non-null slot it waits
+ * for that thread's next outermost read_unlock() (or for the slots to read
+ * null). After that no reader can hold an object unpublished beforehand,
+ * which is what barrier() relies on to invoke every callback retired before
+ * it, whichever thread's list it is on: each callback remembers how many
+ * grace periods had started when it was retired.
+ *
+ * Limitations:
+ * - A section may protect at most HAZARDS_PER_THREAD pointers; one more
+ *   aborts the program.
+ * - A thread that exits without calling unregister_thread() leaves its
+ *   retired list to barrier() and the domain destructor.
+ * - Callbacks must not call barrier().
+ */
+class rcu_domain_hp {
+
+public:
+    static const int HAZARDS_PER_THREAD = 4;
+
+private:
+    static const size_t RETIRE_THRESHOLD = 64;  // Smallest retired list worth a scan
+    static const int SPIN_LIMIT = 1000;         // synchronize() checks before yielding...
+    static const int YIELD_LIMIT = 100;         // ... and before sleeping
+
+    struct Callback {
+        rcu_head *rhp;
+        void (*cbf)(rcu_head *rhp);
+        uint64_t gp;                            // gpStarted when retired
+        std::rcu::callback_executor *executor;  // Null to invoke cbf directly
+        void *context;                          // From executor->capture()
+        size_t charged;                         // Against the reclaim budget
+
+        void invoke() const noexcept
+        {
+            if (executor == nullptr) cbf(rhp);
+            else executor->execute(context, rhp, cbf);
+        }
+    };
+
+    struct ThreadRecord {
+        std::atomic<const void*> hazards[HAZARDS_PER_THREAD];
+        std::atomic<uint64_t> unlocks = { 0 };  // Outermost read_unlock() calls
+        char pad0[128 - (HAZARDS_PER_THREAD + 1) * 8];
+        std::atomic<bool> inUse = { true };
+        ThreadRecord* next = nullptr;           // Registry list, immutable once linked
+        int nesting = 0;
+        int used = 0;                           // Slots taken in the current section
+        std::recursive_mutex retiredMutex;      // Protects retired
+        std::vector<Callback> retired;
+
+        ThreadRecord()
+        {
+            for (int i = 0; i < HAZARDS_PER_THREAD; i++) hazards[i].store(nullptr, std::memory_order_relaxed);
+        }
+    };
+
+    struct Registration {
+        uint64_t domainId;
+        ThreadRecord* rec;
+    };
+
+    const uint64_t domainId;
+    std::atomic<ThreadRecord*> records alignas(128) = { nullptr };
+    std::atomic<int> numRecords = { 0 };
+    std::atomic<uint64_t> gpStarted alignas(128) = { 0 };
+    std::atomic<uint64_t> gpCompleted = { 0 };
+    ThreadRecord orphans;                       // Never protects anything
+    std::atomic<long> budgetItems = { 0 };         // Per scan, 0 for no limit
+    std::atomic<long> budgetMicroseconds = { 0 };  // Per scan, 0 for no limit
+    std::atomic<std::rcu::callback_executor*> executor = { nullptr };
+    std::rcu::detail::reclaim_budget reclaimBudget;
+
+public:
+    rcu_domain_hp() : domainId(next_domain_id()) {}
+
+    rcu_domain_hp(const rcu_domain_hp&) = delete;
+    rcu_domain_hp& operator=(const rcu_domain_hp&) = delete;
+
+    ~rcu_domain_hp()
+    {
+        // No reader may be left, so everything is unprotected now
+        invoke_before(orphans, UINT64_MAX);
+        ThreadRecord* rec = records.load();
+        while (rec != nullptr) {
+            ThreadRecord* next = rec->next;
+            invoke_before(*rec, UINT64_MAX);
+            delete rec;
+            rec = next;
+        }
+    }
+
+    static constexpr bool register_thread_needed() { return true; }
+
+    // Callbacks are only invoked from later retire() calls and barrier()
+    static constexpr bool callbacks_need_retire() { return true; }
+
+    void register_thread()
+    {
+        // Recycle a record left by an unregistered thread, or link a new one
+        ThreadRecord* rec = records.load();
+        for (; rec != nullptr; rec = rec->next) {
+            bool expected = false;
+            if (!rec->inUse.load() && rec->inUse.compare_exchange_strong(expected, true)) break;
+        }
+        if (rec == nullptr) {
+            rec = new ThreadRecord;
+            rec->next = records.load();
+            while (!records.compare_exchange_weak(rec->next, rec)) { }
+            numRecords++;
+        }
+        rec->nesting = 0;
+        rec->used = 0;
+        registrations().push_back(Registration{domainId, rec});
+    }
+
+    void unregister_thread()
+    {
+        std::vector<Registration>& regs = registrations();
+        for (auto it = regs.begin(); it != regs.end(); ++it) {
+            if (it->domainId != domainId) continue;
+            ThreadRecord* rec = it->rec;
+            regs.erase(it);
+            clear_hazards(*rec);
+            // Hand the retired list over to the orphan record
+            {
+                std::lock_guard<std::recursive_mutex> lock(rec->retiredMutex);
+                std::lock_guard<std::recursive_mutex> olock(orphans.retiredMutex);
+                orphans.retired.insert(orphans.retired.end(), rec->retired.begin(), rec->retired.end());
+                rec->retired.clear();
+            }
+            rec->inUse.store(false);
+            return;
+        }
+    }
+
+    void thread_offline() noexcept {}
+    void thread_online() noexcept {}
+
+    static constexpr bool quiescent_state_needed() { return false; }
+    void quiescent_state() noexcept {}
+
+    void read_lock() noexcept
+    {
+        my_record()->nesting++;
+    }
+
+    void read_unlock() noexcept
+    {
+        ThreadRecord* const rec = my_record();
+        if (--rec->nesting != 0) return;
+        clear_hazards(*rec);
+    }
+
+    // Loads src and keeps the object it points to from being reclaimed
+    // until the outermost read_unlock().
+    template<class T>
+    T* protect(const std::atomic<T*>& src) noexcept
+    {
+        static_assert(has_rcu_head_of<T>(0),
+                      "protect(src) needs rcu_head_of(T*); pass the address retire() is given as protect(src, key)");
+        return protect(src, [](T* q) { return rcu_head_of(q); });
+    }
+
+    // As above, for an object retired as key(p)
+    template<class T, class Key>
+    T* protect(const std::atomic<T*>& src, Key key) noexcept
+    {
+        ThreadRecord* const rec = my_record();
+        if (rec->used == HAZARDS_PER_THREAD) std::abort();
+        std::atomic<const void*>& slot = rec->hazards[rec->used++];
+        T* p = src.load(std::memory_order_relaxed);
+        for (;;) {
+            slot.store(p == nullptr ? nullptr : static_cast<const void*>(key(p)), std::memory_order_relaxed);
+            // Orders the publication before the re-read; pairs with the
+            // fence in scan() and synchronize().
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            T* const again = src.load(std::memory_order_acquire);
+            if (again == p) return p;
+            p = again;
+        }
+    }
+
+    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), const size_t bytes = 0)
+    {
+        ThreadRecord* const rec = my_record();
+        size_t charged;
+        bool admitted = reclaimBudget.admit(bytes, charged, false);
+        if (!admitted && rec != nullptr && rec->nesting != 0) {
+            // Our own section would hold up the grace period
+            charged = reclaimBudget.charge(bytes);
+            admitted = true;
+        }
+        std::rcu::callback_executor* const ex = executor.load(std::memory_order_acquire);
+        void* const context = (ex == nullptr) ? nullptr : ex->capture();
+        if (!admitted) {
+            // Over the hard limit: reclaim it here, executor and all
+            synchronize();
+            Callback{rhp, cbf, 0, ex, context, 0}.invoke();
+            return;
+        }
+        ThreadRecord& target = (rec == nullptr) ? orphans : *rec;
+        std::lock_guard<std::recursive_mutex> lock(target.retiredMutex);
+        target.retired.push_back(Callback{rhp, cbf, gpStarted.load(), ex, context, charged});
+        const size_t threshold = (size_t)2 * HAZARDS_PER_THREAD * numRecords.load();
+        if ((target.retired.size() >= threshold && target.retired.size() >= RETIRE_THRESHOLD) ||
+            reclaimBudget.over_soft()) scan(target);
+    }
+
+    void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp))
+    {
+        ThreadRecord* const rec = my_record();
+        ThreadRecord& target = (rec == nullptr) ? orphans : *rec;
+        std::lock_guard<std::recursive_mutex> lock(target.retiredMutex);
+        target.retired.push_back(Callback{rhp, cbf, gpStarted.load(), nullptr, nullptr, 0});
+        scan(target);
+    }
+
+    void set_callback_budget(const long maxItems, const long maxMicroseconds) noexcept
+    {
+        budgetItems.store(maxItems < 0 ? 0 : maxItems, std::memory_order_relaxed);
+        budgetMicroseconds.store(maxMicroseconds < 0 ? 0 : maxMicroseconds, std::memory_order_relaxed);
+    }
+
+    void set_callback_executor(std::rcu::callback_executor* const ex) noexcept
+    {
+        executor.store(ex, std::memory_order_release);
+    }
+
+    // Only retiring threads reclaim, so none may block waiting for it:
+    // past the hard limit retire() always reclaims inline.
+    void set_reclaim_budget(const size_t softBytes, const size_t hardBytes,
+                            const std::rcu::over_hard_limit policy = std::rcu::over_hard_limit::reclaim_inline) noexcept
+    {
+        reclaimBudget.set(softBytes, hardBytes, policy);
+    }
+    size_t pending_bytes() const noexcept { return reclaimBudget.pending_bytes(); }
+
+    void synchronize() noexcept { synchronize_gp(); }
+    // As synchronize(), but polls a reader that holds it up every microsecond
+    // or so rather than yielding and then sleeping for 50
+    void synchronize_expedited() noexcept { synchronize_gp(true); }
+
+    bool try_synchronize(const std::rcu::gp_state cookie) noexcept
+    {
+        return synchronize_until(cookie, std::rcu::gp_deadline::min());
+    }
+
+    // The first call with a cookie starts its grace period; retries only
+    // scan the readers again.
+    bool synchronize_until(const std::rcu::gp_state cookie, const std::rcu::gp_deadline deadline) noexcept
+    {
+        if (poll_state(cookie)) return true;
+        uint64_t started = gpStarted.load();
+        while (started < cookie && !gpStarted.compare_exchange_weak(started, cookie)) { }
+        return wait_for_readers(cookie, false, deadline);
+    }
+
+    std::rcu::gp_state get_state() noexcept { return gpStarted.load() + 1; }
+    bool poll_state(const std::rcu::gp_state cookie) noexcept { return gpCompleted.load() >= cookie; }
+    void cond_synchronize(const std::rcu::gp_state cookie) noexcept
+    {
+        if (!poll_state(cookie)) synchronize();
+    }
+
+    // Invokes every callback retired before the call, whichever thread
+    // retired it.
+    void barrier() noexcept
+    {
+        const uint64_t gp = synchronize_gp();
+        for (ThreadRecord* rec = records.load(); rec != nullptr; rec = rec->next) invoke_before(*rec, gp);
+        invoke_before(orphans, gp);
+    }
+
+private:
+    // Returns the number of the grace period it waited for; callbacks
+    // retired before that number was taken are then unprotected.
+    uint64_t synchronize_gp(const bool expedited = false) noexcept
+    {
+        const uint64_t gp = gpStarted.fetch_add(1) + 1;
+        wait_for_readers(gp, expedited, std::rcu::gp_deadline::max());
+        return gp;
+    }
+
+    // Waits out the readers of grace period gp, which has started, and
+    // records it as completed; false if the deadline passed first.
+    bool wait_for_readers(const uint64_t gp, const bool expedited, const std::rcu::gp_deadline deadline) noexcept
+    {
+        const bool timed = deadline != std::rcu::gp_deadline::max();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (ThreadRecord* rec = records.load(); rec != nullptr; rec = rec->next) {
+            const uint64_t unlocks = rec->unlocks.load(std::memory_order_acquire);
+            for (int i = 0; !hazards_clear(*rec) && rec->unlocks.load(std::memory_order_acquire) == unlocks; i++) {
+                if (timed && std::chrono::steady_clock::now() >= deadline) return false;
+                if (i < SPIN_LIMIT) continue;
+                if (expedited) std::this_thread::sleep_for(std::chrono::microseconds(1));
+                else if (i < SPIN_LIMIT + YIELD_LIMIT) std::this_thread::yield();
+                else if (timed) std::this_thread::sleep_until(std::min(deadline, std::chrono::steady_clock::now() +
+                                                                       std::chrono::microseconds(50)));
+                else std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t completed = gpCompleted.load();
+        while (completed < gp && !gpCompleted.compare_exchange_weak(completed, gp)) { }
+        return true;
+    }
+
+    static uint64_t next_domain_id()
+    {
+        static std::atomic<uint64_t> lastId = { 0 };
+        return ++lastId;
+    }
+
+    static std::vector<Registration>& registrations()
+    {
+        static thread_local std::vector<Registration> regs;
+        return regs;
+    }
+
+    ThreadRecord* my_record() noexcept
+    {
+        for (const Registration& r : registrations()) {
+            if (r.domainId == domainId) return r.rec;
+        }
+        return nullptr;
+    }
+
+    template<class T>
+    static constexpr auto has_rcu_head_of(int) -> decltype(rcu_head_of(static_cast<T*>(nullptr)), bool())
+    {
+        return true;
+    }
+
+    template<class T>
+    static constexpr bool has_rcu_head_of(long) { return false; }
+
+    static void clear_hazards(ThreadRecord& rec) noexcept
+    {
+        for (int i = 0; i < rec.used; i++) rec.hazards[i].store(nullptr, std::memory_order_release);
+        rec.used = 0;
+        rec.unlocks.store(rec.unlocks.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    static bool hazards_clear(ThreadRecord& rec) noexcept
+    {
+        for (int i = 0; i < HAZARDS_PER_THREAD; i++) {
+            if (rec.hazards[i].load(std::memory_order_acquire) != nullptr) return false;
+        }
+        return true;
+    }
+
+    // Invokes the unprotected part of rec.retired, within the budget.
+    // Caller holds rec.retiredMutex.
+    void scan(ThreadRecord& rec)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards;
+        for (ThreadRecord* r = records.load(); r != nullptr; r = r->next) {
+            for (int i = 0; i < HAZARDS_PER_THREAD; i++) {
+                const void* h = r->hazards[i].load(std::memory_order_acquire);
+                if (h != nullptr) hazards.push_back(h);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        // Callbacks may retire more objects into rec.retired, so work on a copy
+        std::vector<Callback> batch;
+        batch.swap(rec.retired);
+        const bool pressed = reclaimBudget.over_soft();
+        const long maxItems = pressed ? 0 : budgetItems.load(std::memory_order_relaxed);
+        const long maxMicroseconds = pressed ? 0 : budgetMicroseconds.load(std::memory_order_relaxed);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<Callback> kept;
+        long n = 0;
+        for (const Callback& cb : batch) {
+            const bool overBudget = (maxItems != 0 && n >= maxItems) ||
+                (maxMicroseconds != 0 && n != 0 &&
+                 std::chrono::steady_clock::now() - start >= std::chrono::microseconds(maxMicroseconds));
+            if (overBudget || std::binary_search(hazards.begin(), hazards.end(), (const void*)cb.rhp)) {
+                kept.push_back(cb);
+                continue;
+            }
+            cb.invoke();
+            reclaimBudget.credit(cb.charged);
+            n++;
+        }
+        rec.retired.insert(rec.retired.begin(), kept.begin(), kept.end());
+    }
+
+    // Invokes the callbacks retired before grace period gp started,
+    // protected or not.
+    void invoke_before(ThreadRecord& rec, const uint64_t gp)
+    {
+        std::lock_guard<std::recursive_mutex> lock(rec.retiredMutex);
+        std::vector<Callback> batch;
+        batch.swap(rec.retired);
+        std::vector<Callback> kept;
+        for (const Callback& cb : batch) {
+            if (cb.gp < gp) {
+                cb.invoke();
+                reclaimBudget.credit(cb.charged);
+            } else {
+                kept.push_back(cb);
+            }
+        }
+        rec.retired.insert(rec.retired.begin(), kept.begin(), kept.end());
+    }
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#ifdef __linux__
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#ifdef RSEQ_SIG
+#define RCU_DOMAIN_RSEQ_HAVE_RSEQ 1
+#endif
+#endif
+#endif
+#endif
+#include "rcu_counter_domain.hpp"
+
+/**
+ * RCU with per-CPU reader counters, for processes with many more threads
+ * than CPUs: the memory and the grace-period cost follow the number of
+ * CPUs, and no thread ever registers.
+ *
+ * Every possible CPU has a lock and an unlock counter for each of two indexes, as in
+ * rcu_domain_srcu; read_lock() returns the index it counted on as a token for
+ * read_unlock(token), so the domain is used through rcu_guard,
+ * basic_rcu_reader or rcu_domain_wrapper like any other. synchronize()
+ * waits for stragglers on the inactive index, flips the index, and waits
+ * for the old one, an index being idle when the sum of its unlock counters
+ * (read first) equals the sum of its lock counters.
+ *
+ * On x86-64 Linux with glibc 2.35 or later the kernel's rseq area is
+ * registered for every thread, and read_lock()/read_unlock() bump the
+ * counter of the current CPU with a restartable sequence: it reads the CPU
+ * number from the rseq area and adds one with a plain, non-atomic add,
+ * which the kernel restarts should the thread be preempted or migrated in
+ * between; the counters are sized for every CPU id the kernel may hand
+ * out, so the sequence needs no bounds check. When
+ * membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED) is available as well, the
+ * read side has no fence either, and each wait for readers in
+ * synchronize() forces the barriers with one membarrier() before it polls
+ * and one after. Without rseq the counters
+ * are bumped with relaxed atomic adds and the read side has full fences, as
+ * in rcu_domain_srcu. effective_read_side() tells which one is in use.
+ *
+ * Everything but the read side is std::rcu::detail::counter_domain, shared
+ * with rcu_domain_srcu: retire() queues the callback for the domain's
+ * callback thread, which waits for one grace period per batch, and
+ * set_callback_budget(), retire_urgent(), set_callback_executor() and
+ * set_reclaim_budget() behave as there.
+ *
+ * Limitations:
+ * - The rseq path assumes that the rseq area of every thread is registered,
+ *   as glibc does for all threads once it has for the first one.
+ */
+class rcu_domain_rseq : public std::rcu::detail::counter_domain {
+public:
+    enum class read_side { rseq_membarrier, rseq_fenced, atomic };
+
+private:
+    const read_side readSide;
+
+    rcu_domain_rseq(const read_side readSide, int)
+        : counter_domain(readSide == read_side::rseq_membarrier), readSide(readSide) {}
+
+public:
+    // useRseq = false forces the atomic counters, for comparison
+    explicit rcu_domain_rseq(const bool useRseq = true) : rcu_domain_rseq(pick_read_side(useRseq), 0) {}
+
+    read_side effective_read_side() const noexcept { return readSide; }
+
+    token read_lock() noexcept
+    {
+        const token idx = index.load(std::memory_order_relaxed) & 1;
+        if (readSide == read_side::atomic) {
+            counters[my_cpu()].locks[idx].fetch_add(1, std::memory_order_relaxed);
+        } else {
+            rseq_increment(&counters[0].locks[idx]);
+        }
+        // Orders the increment before the critical section; pairs with the
+        // fence between the two sums in readers_gone(), or with the
+        // membarrier() before them.
+        if (readSide == read_side::rseq_membarrier) {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return idx;
+    }
+
+    void read_unlock(const token idx) noexcept
+    {
+        if (readSide == read_side::rseq_membarrier) {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        } else {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        if (readSide == read_side::atomic) {
+            counters[my_cpu()].unlocks[idx].fetch_add(1, std::memory_order_relaxed);
+        } else {
+            rseq_increment(&counters[0].unlocks[idx]);
+        }
+    }
+
+private:
+    static read_side pick_read_side(const bool useRseq) noexcept
+    {
+#ifdef RCU_DOMAIN_RSEQ_HAVE_RSEQ
+        if (useRseq && __rseq_size > 0) {
+            int cpu;
+            __asm__ ("movl %%fs:4(%1), %0" : "=r" (cpu) : "r" ((long)__rseq_offset));
+            // Negative while unregistered, or if registration failed
+            if (cpu >= 0) {
+                return membarrier_register() ? read_side::rseq_membarrier : read_side::rseq_fenced;
+            }
+        }
+#endif
+        return read_side::atomic;
+    }
+
+#ifdef RCU_DOMAIN_RSEQ_HAVE_RSEQ
+    // Adds one to the counter at the same offset as base within the
+    // current CPU's CpuCounters. Restarted from the top by the kernel on
+    // preemption, migration or signal delivery before the add.
+    static void rseq_increment(std::atomic<uint64_t>* base) noexcept
+    {
+        __asm__ __volatile__ (
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0, 0\n\t"                    // version, flags
+            ".quad 1f, 2f - 1f, 4f\n\t"         // start, length, abort
+            ".popsection\n\t"
+            "6:\n\t"
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %%fs:8(%[rseq])\n\t"   // rseq_cs
+            "1:\n\t"
+            "movl %%fs:4(%[rseq]), %%eax\n\t"   // cpu_id
+            "shlq $7, %%rax\n\t"                // * sizeof(CpuCounters)
+            "addq $1, (%[base], %%rax)\n\t"
+            "2:\n\t"
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"        // ud1, followed by the signature
+            ".long 0x53053053\n\t"              // RSEQ_SIG
+            "4:\n\t"
+            "jmp 6b\n\t"
+            ".popsection\n\t"
+            :
+            : [rseq] "r" ((long)__rseq_offset), [base] "r" (base)
+            : "memory", "cc", "rax");
+    }
+#else
+    static void rseq_increment(std::atomic<uint64_t>*) noexcept {}
+#endif
+};
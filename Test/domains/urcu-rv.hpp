@@ -1,14 +1,34 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
 #include <vector>
-#include <future>
+#include <set>
 #include <iostream>
+#include <fstream>
+#include <string>
+#ifdef __linux__
+#include <climits>
+#include <ctime>
+#include <cstdlib>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef __NR_membarrier
+#include <linux/membarrier.h>
+#endif
+#endif
 #include "rcu_domain.hpp"
-
-thread_local int tl_urcu_rv_tid = -1;
+#include "rcu_trace.hpp"
 
 /**
  * This is URCU Reader's Version, a Userspace RCU that uses only the C++
@@ -17,119 +37,560 @@ thread_local int tl_urcu_rv_tid = -1;
  * Based on the original algorithm by Correia and Ramalhete described in
  * the paper "Correct traversal of Lazy Lists".
  *
- * Reader registration works by doing a CAS in readersVersion[i] from UNASSIGNED
- * to NOT_READING state. Threads always start from i=0 and move forward.
- * I'm sure we can come up with a more flexible ReadIndicator that at the same
- * time allows for registration, but for the time being its ok.
+ * Each registered thread owns a reader slot, whose version the outermost
+ * read_lock() sets to reclaimerVersion and the outermost read_unlock()
+ * clears; a grace period bumps reclaimerVersion and waits for every slot
+ * to catch up. retire() hands callbacks to reclaimer threads, which wait
+ * out one grace period per batch. A thread may register with any number
+ * of instances.
  *
  * Limitations:
- * - read_lock()/read_unlock() are not reentrant;
- * - The number of registered (reader) threads can not be larger than maxThreads
- * - The retire()/barrier() implementation uses futures and async for simplicity but it is crappy and untested.
+ * - Callbacks must not call barrier() (just like liburcu's call_rcu()).
  *
  *
  */
 class rcu_domain_rv {
 
-    static const int CLPAD = (128/sizeof(uint64_t));
     static const uint64_t NOT_READING = 0xFFFFFFFFFFFFFFFE;
     static const uint64_t UNASSIGNED =  0xFFFFFFFFFFFFFFFD;
+    static const uint64_t REFRESHING =  0xFFFFFFFFFFFFFFFC;  // A node summary being reset
+
+    static const int SPIN_LIMIT = 1000;         // Loads before the first yield
+    static const int YIELD_LIMIT = 100;         // Yields before the first park
+    static const long PARK_TIMEOUT_US = 1000;
+    static const long EXPEDITED_SLEEP_US = 1;   // Timer slack makes it longer
+
+public:
+    // How a grace period waits for a reader: spin only, spin and then yield,
+    // or spin, yield and then park on a futex that the reader's read_unlock()
+    // wakes. The wakeup may be missed, so parking lasts PARK_TIMEOUT_US at most.
+    enum class wait_policy { spin, yield, park };
+    // membarrier: a read side with no fences, paid for by a membarrier() per
+    // grace period as in liburcu's memb flavor; falls back to fenced where
+    // the kernel lacks it (see effective_read_side())
+    enum class read_side { fenced, membarrier };
+    // numa_tree: a slot group per NUMA node, first touched on that node,
+    // with a summary of its oldest reader's version; a grace period skips
+    // the slots of a node whose summary shows it quiet (see NodeGroup)
+    enum class reader_tracking { flat, numa_tree };
+
+private:
+
+    struct CallbackNode {
+        rcu_head* rhp;
+        void (*cbf)(rcu_head *rhp);
+        CallbackNode* next;
+        std::rcu::callback_executor* executor;  // Null to invoke cbf directly
+        void* context;                          // From executor->capture()
+        size_t charged;                         // Against the reclaim budget
+        size_t bytes;                           // As given to retire()
+        uint64_t retiredNs;                     // For the retire-to-free histogram
+
+        void invoke() noexcept
+        {
+            if (executor == nullptr) cbf(rhp);
+            else executor->execute(context, rhp, cbf);
+        }
+    };
+
+    // The version written by the reader and the callback stack pushed by
+    // retire() sit on separate 128-byte lines.
+    struct ReaderSlot {
+        std::atomic<uint64_t> version;
+        std::atomic<int> waiters;               // Futex word, 1 when an updater is parked
+        char pad0[128-sizeof(std::atomic<uint64_t>)-sizeof(std::atomic<int>)];
+        std::atomic<CallbackNode*> callbacks;   // Drained by reclaimer index%numReclaimers
+        std::atomic<uint64_t>* occupiedWord;    // Bitmap word holding this slot's bit
+        uint64_t occupiedBit;
+        std::atomic<long> osTid;                // Of the registered thread, for the stall watchdog
+        int index;
+        char pad1[128-sizeof(std::atomic<CallbackNode*>)-sizeof(std::atomic<uint64_t>*)
+                  -sizeof(uint64_t)-sizeof(std::atomic<long>)-sizeof(int)];
+    };
+
+    // Slots come in a chain of segments, each doubling the capacity, only
+    // ever appended, so that grace periods walk it without a lock. The
+    // bitmap lets them visit only registered slots.
+    struct Segment {
+        ReaderSlot* const slots;
+        const int size;
+        const int words;
+        std::atomic<uint64_t>* const occupied;  // Bit i%64 of word i/64 set while slot i is registered
+        std::atomic<Segment*> next = { nullptr };
+
+        Segment(const int first, const int size)
+            : slots{new ReaderSlot[size]}, size{size}, words{(size+63)/64},
+              occupied{new std::atomic<uint64_t>[(size+63)/64]}
+        {
+            for (int w=0; w < words; w++) occupied[w].store(0, std::memory_order_relaxed);
+            for (int i=0; i < size; i++) {
+                slots[i].version.store(UNASSIGNED, std::memory_order_relaxed);
+                slots[i].waiters.store(0, std::memory_order_relaxed);
+                slots[i].callbacks.store(nullptr, std::memory_order_relaxed);
+                slots[i].osTid.store(0, std::memory_order_relaxed);
+                slots[i].occupiedWord = &occupied[i/64];
+                slots[i].occupiedBit = uint64_t(1) << (i%64);
+                slots[i].index = first+i;
+            }
+        }
+        ~Segment() { delete[] occupied; delete[] slots; }
+    };
+
+    // The slots of the readers registered from one NUMA node. In numa_tree
+    // mode oldestVersion is no newer than the version of any reader inside a
+    // section, and NOT_READING once a grace period has found the node quiet.
+    // Only an outermost read_lock() that finds it newer than its own version
+    // stores to it, so readers of a busy node just load a shared line; the
+    // grace period resets it (see refresh_summary()).
+    struct NodeGroup {
+        std::atomic<uint64_t> oldestVersion = { NOT_READING };
+        char pad[128-sizeof(std::atomic<uint64_t>)];
+        Segment* const firstSegment;
+        Segment* lastSegment;                     // Protected by registryMutex
+        int capacity;                             // Protected by registryMutex
+        std::vector<ReaderSlot*> freeSlots;       // Protected by registryMutex
+
+        explicit NodeGroup(Segment* seg) : firstSegment{seg}, lastSegment{seg}, capacity{0}
+        {
+            add_segment(seg);
+        }
+
+        void add_segment(Segment* seg)
+        {
+            if (seg != firstSegment) {
+                lastSegment->next.store(seg, std::memory_order_release);
+                lastSegment = seg;
+            }
+            capacity += seg->size;
+            for (int i=seg->size-1; i >= 0; i--) freeSlots.push_back(&seg->slots[i]);
+        }
+
+        ~NodeGroup()
+        {
+            for (Segment* seg = firstSegment; seg != nullptr; ) {
+                Segment* next = seg->next.load();
+                delete seg;
+                seg = next;
+            }
+        }
+    };
+
+    // A thread's registration with one domain
+    struct ThreadState {
+        rcu_domain_rv* const domain;
+        const uint64_t domainId;
+        ReaderSlot* const slot;
+        NodeGroup* const group;
+        std::atomic<uint64_t>* const summary;     // group->oldestVersion, null unless numa_tree
+        std::rcu::detail::stats_block* const stats;
+        int nesting;
+    };
+
+    // All of a thread's registrations. The destructor gives the slots back
+    // when a thread exits while still registered.
+    struct Registrations {
+        std::vector<ThreadState*> states;
+        ~Registrations();
+    };
+
+    static const int CACHE_SIZE = 4;    // Direct-mapped on domainId
+
+    // Function-local, so that the header can be included by several
+    // translation units; the cache is constant-initialized, so reading it
+    // costs no more than a namespace-scope thread_local.
+    static ThreadState** tl_cache() noexcept
+    {
+        static thread_local ThreadState* cache[CACHE_SIZE];
+        return cache;
+    }
 
-    const int maxThreads; // Defaults to 32
+    static Registrations& tl_registrations()
+    {
+        static thread_local Registrations registrations;
+        return registrations;
+    }
+
+    struct Reclaimer {
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable wakeup;         // Reclaimer waits here for work
+        std::condition_variable passDone;       // barrier() waits here for passes
+        std::atomic<bool> sleeping = { false };
+        bool passRequested = false;
+        uint64_t passesStarted = 0;
+        uint64_t passesCompleted = 0;
+        uint64_t readyQueued = 0;               // Sequence of the last callback put on the ready list
+        uint64_t readyInvoked = 0;              // Sequence of the last one invoked off it
+        CallbackNode* ready = nullptr;          // Over-budget backlog, used by the reclaimer only
+        CallbackNode** readyTail = &ready;
+    };
+
+    struct StallWatchdog {
+        std::thread thread;
+        std::mutex mtx;
+        std::condition_variable wakeup;         // Signalled to stop
+        bool stopping = false;
+    };
+
+    const int numReclaimers; // Defaults to 1
+    const wait_policy waitPolicy; // Defaults to park
+    const bool fenceFreeReaders;  // read_side::membarrier and the kernel supports it
+    const bool numaTree;
+    const int initialThreads;     // Size of the first segment of each group
+    const int numGroups;          // Number of NUMA nodes, or 1 when flat
+    const uint64_t domainId;
     std::atomic<uint64_t> reclaimerVersion alignas(128) = { 0 };
-    std::atomic<uint64_t>* readersVersion alignas(128);
-    std::mutex listMutex;
-    std::vector<std::future<void>> futureList;
+    std::atomic<uint64_t> completedVersion = { 0 };  // Highest waitForVersion reached
+    std::atomic<NodeGroup*>* const groups;           // Null until a thread registers from that node
+    std::atomic<CallbackNode*> unregisteredCallbacks alignas(128) = { nullptr };
+    std::atomic<CallbackNode*> urgentCallbacks alignas(128) = { nullptr };
+    std::atomic<long> budgetItems = { 0 };         // Per pass, 0 for no limit
+    std::atomic<long> budgetMicroseconds = { 0 };  // Per pass, 0 for no limit
+    std::atomic<std::rcu::callback_executor*> executor = { nullptr };
+    std::rcu::detail::reclaim_budget reclaimBudget;
+    std::mutex registryMutex;
+    int nextIndex = 0;                    // Protected by registryMutex
+    uint64_t registeredThreads = 0;       // Protected by registryMutex
+    std::rcu::detail::stats_registry statsRegistry;
+    Reclaimer* reclaimers;
+    std::atomic<bool> stopping = { false };
+    bool autoRegister = false;            // Set before any thread reads
+    StallWatchdog* watchdog = nullptr;
 
 public:
-    rcu_domain_rv(const int maxThreads=32): maxThreads{maxThreads}
+    rcu_domain_rv(const int initialThreads=32, const int numReclaimers=1,
+                  const wait_policy waitPolicy=wait_policy::park,
+                  const read_side readSide=read_side::fenced,
+                  const reader_tracking tracking=reader_tracking::flat)
+        : numReclaimers{numReclaimers < 1 ? 1 : numReclaimers}, waitPolicy{waitPolicy},
+          fenceFreeReaders{readSide == read_side::membarrier && membarrier_register()},
+          numaTree{tracking == reader_tracking::numa_tree},
+          initialThreads{initialThreads < 1 ? 1 : initialThreads},
+          numGroups{numaTree ? num_numa_nodes() : 1},
+          domainId{next_domain_id()},
+          groups{new std::atomic<NodeGroup*>[numGroups]}
     {
-        readersVersion = new std::atomic<uint64_t>[maxThreads*CLPAD];
-        for (int i=0; i < maxThreads; i++) {
-            readersVersion[i*CLPAD].store(UNASSIGNED, std::memory_order_relaxed);
+        for (int g=0; g < numGroups; g++) groups[g].store(nullptr, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(live_domains_mutex());
+            live_domains().insert(domainId);
+        }
+        reclaimers = new Reclaimer[this->numReclaimers];
+        for (int r=0; r < this->numReclaimers; r++) {
+            reclaimers[r].thread = std::thread(&rcu_domain_rv::reclaimer_loop, this, r);
         }
     }
 
     ~rcu_domain_rv() {
-        delete[] readersVersion;
+        stop_stall_watchdog();
+        {
+            std::lock_guard<std::mutex> lock(live_domains_mutex());
+            live_domains().erase(domainId);
+        }
+        // Reclaimers drain whatever is still queued before exiting
+        stopping.store(true);
+        for (int r=0; r < numReclaimers; r++) {
+            std::lock_guard<std::mutex> lock(reclaimers[r].mtx);
+            reclaimers[r].wakeup.notify_one();
+        }
+        for (int r=0; r < numReclaimers; r++) reclaimers[r].thread.join();
+        delete[] reclaimers;
+        for (int g=0; g < numGroups; g++) delete groups[g].load();
+        delete[] groups;
     }
 
+    // Pops a slot from the free list of the caller's node group. A thread
+    // that exits still registered gives it back from a thread_local destructor.
     void register_thread()
     {
-        if (tl_urcu_rv_tid != -1) {
+        if (my_state() != nullptr) {
             std::cout << "Warning: calling register_thread() on an already registered thread\n";
             return;
         }
-        for (int i=0; i < maxThreads; i++) {
-            if (readersVersion[i*CLPAD].load() != UNASSIGNED) continue;
-            uint64_t curr = UNASSIGNED;
-            if (readersVersion[i*CLPAD].compare_exchange_strong(curr, NOT_READING)) {
-                 tl_urcu_rv_tid = i;
-                 return;
+        const int g = numaTree ? current_numa_node() % numGroups : 0;
+        NodeGroup* group;
+        ReaderSlot* slot;
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            // Segments are allocated and initialized by a thread running on
+            // the group's node, so first touch places them there.
+            group = groups[g].load();
+            if (group == nullptr) {
+                group = new NodeGroup(new Segment(nextIndex, initialThreads));
+                nextIndex += initialThreads;
+                groups[g].store(group, std::memory_order_release);
+            } else if (group->freeSlots.empty()) {
+                group->add_segment(new Segment(nextIndex, group->capacity));
+                nextIndex += group->lastSegment->size;
             }
+            slot = group->freeSlots.back();
+            group->freeSlots.pop_back();
+            registeredThreads++;
         }
-        std::cout << "Error: too many threads already registered\n";
+        slot->osTid.store(os_thread_id(), std::memory_order_relaxed);
+        slot->version.store(NOT_READING);
+        // Once the bit is visible, so is the slot; a scanner that still
+        // misses the bit ordered its reclaimerVersion bump before our first
+        // read_lock(), which will therefore pick up the new version.
+        slot->occupiedWord->fetch_or(slot->occupiedBit);
+        ThreadState* ts = new ThreadState{this, domainId, slot, group,
+                                          numaTree ? &group->oldestVersion : nullptr, &statsRegistry.local(), 0};
+        tl_registrations().states.push_back(ts);
+        tl_cache()[domainId % CACHE_SIZE] = ts;
     }
 
     void unregister_thread()
     {
-        if (tl_urcu_rv_tid == -1) {
+        ThreadState* ts = my_state();
+        if (ts == nullptr) {
             std::cout << "Error: calling unregister_thread() from a thread that was never registered\n";
             return;
         }
-        readersVersion[tl_urcu_rv_tid*CLPAD].store(UNASSIGNED);
+        ReaderSlot* slot = ts->slot;
+        NodeGroup* group = ts->group;
+        slot->version.store(UNASSIGNED);
+        slot->occupiedWord->fetch_and(~slot->occupiedBit);
+        forget(ts);
+        // Callbacks still on the slot's stack are drained as usual
+        std::lock_guard<std::mutex> lock(registryMutex);
+        group->freeSlots.push_back(slot);
+        registeredThreads--;
     }
 
+    // For a domain that is handed to code which never registers its threads,
+    // such as the process-wide default domain. Call before any read_lock().
+    void set_auto_register(const bool on) noexcept { autoRegister = on; }
+
+    // Sections nest; inner ones only count
     void read_lock() noexcept
     {
-        const int tid = tl_urcu_rv_tid;
+        ThreadState* const ts = reader_state();
+        if (ts->nesting++ != 0) return;
+        ReaderSlot* const slot = ts->slot;
+        std::atomic<uint64_t>* const summary = ts->summary;
+        if (fenceFreeReaders) {
+            // synchronize_tid()'s membarrier() provides the store-load ordering
+            const uint64_t rv = reclaimerVersion.load(std::memory_order_relaxed);
+            slot->version.store(rv, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            if (summary != nullptr) lower_summary(*summary, rv, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            const uint64_t nrv = reclaimerVersion.load(std::memory_order_relaxed);
+            if (rv != nrv) slot->version.store(nrv, std::memory_order_relaxed);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            return;
+        }
         const uint64_t rv = reclaimerVersion.load();
-        readersVersion[tid*CLPAD].store(rv);
+        slot->version.store(rv);
+        // Before the reload: a grace period that still finds the node quiet
+        // bumped reclaimerVersion before this, so the reload sees its version
+        if (summary != nullptr) lower_summary(*summary, rv, std::memory_order_seq_cst);
         const uint64_t nrv = reclaimerVersion.load();
-        if (rv != nrv) readersVersion[tid*CLPAD].store(nrv, std::memory_order_relaxed);
+        if (rv != nrv) slot->version.store(nrv, std::memory_order_relaxed);
     }
 
     void read_unlock() noexcept
     {
-        const int tid = tl_urcu_rv_tid;
-        readersVersion[tid*CLPAD].store(NOT_READING, std::memory_order_release);
+        ThreadState* const ts = my_state();
+        if (--ts->nesting != 0) return;
+        ReaderSlot* const slot = ts->slot;
+        slot->version.store(NOT_READING, std::memory_order_release);
+        if (slot->waiters.load(std::memory_order_relaxed) != 0) {
+            slot->waiters.store(0, std::memory_order_relaxed);
+            futex_wake(slot->waiters);
+        }
     }
 
     void synchronize() noexcept { synchronize_tid(); }
+    // Never yields or parks; see poll_readers()
+    void synchronize_expedited() noexcept { synchronize_tid(-1, true); }
 
-    void synchronize_tid(const int mytid = -1) noexcept
+    read_side effective_read_side() const noexcept
     {
-        const int tid = (mytid == -1) ? tl_urcu_rv_tid : mytid;
+        return fenceFreeReaders ? read_side::membarrier : read_side::fenced;
+    }
+
+    void synchronize_tid(const int mytid = -1, const bool expedited = false) noexcept
+    {
+        const int tid = (mytid == -1) ? my_index() : mytid;
         const uint64_t waitForVersion = reclaimerVersion.load()+1;
         auto tmp = waitForVersion-1;
         reclaimerVersion.compare_exchange_strong(tmp, waitForVersion);
-        for (int i=0; i < maxThreads; i++) {
-            // Handle the quiescent_state() case: if it's the same thread, just skip.
-            // If there is an error in the program and we were called inside a
-            // block of read_lock()/unlock() then this will cause errors.
-            if (tid == i) continue;
-            while (readersVersion[i*CLPAD].load() < waitForVersion) {  // spin
-                // TODO: find a better way to spin... maybe spin a random number of iterations
-                // and then call this_thread::yield() ?
-            }
+        RCU_PROBE2(gp_start, waitForVersion, tid);
+        wait_for_readers(tid, waitForVersion, expedited, std::rcu::gp_deadline::max(), nullptr);
+        RCU_PROBE2(gp_end, waitForVersion, tid);
+    }
+
+    // The calling thread's slot index, or -1; what the functions below report
+    int reader_slot() const noexcept { return my_index(); }
+
+    // Trying again with the same cookie resumes the same grace period
+    bool try_synchronize(const std::rcu::gp_state cookie, int* const blockingSlot = nullptr) noexcept
+    {
+        return synchronize_until(cookie, std::rcu::gp_deadline::min(), blockingSlot);
+    }
+
+    // Waits for the grace period of cookie (from get_state()) until the
+    // deadline. Its only state is reclaimerVersion having reached cookie, so
+    // a retry with the same cookie just looks at the slots again, and
+    // readers that started after the first attempt do not hold it up. On
+    // timeout, *blockingSlot (if given) receives the index of the reader
+    // slot it was waiting for, as in synchronize_tid().
+    bool synchronize_until(const std::rcu::gp_state cookie, const std::rcu::gp_deadline deadline,
+                           int* const blockingSlot = nullptr) noexcept
+    {
+        if (poll_state(cookie)) return true;
+        uint64_t v = reclaimerVersion.load();
+        while (v < cookie && !reclaimerVersion.compare_exchange_weak(v, cookie)) { }
+        return wait_for_readers(my_index(), cookie, false, deadline, blockingSlot);
+    }
+
+    // Readers that might still hold an object unpublished before this call
+    // have at most the current reclaimerVersion, so the first grace period
+    // waiting for a newer version covers them.
+    std::rcu::gp_state get_state() noexcept { return reclaimerVersion.load()+1; }
+    bool poll_state(std::rcu::gp_state cookie) noexcept { return completedVersion.load() >= cookie; }
+    // The latest grace period started, for tracing (see rcu_trace.hpp)
+    uint64_t gp_sequence() const noexcept { return reclaimerVersion.load(std::memory_order_relaxed); }
+    void cond_synchronize(std::rcu::gp_state cookie) noexcept { if (!poll_state(cookie)) synchronize(); }
+
+    // Pushes onto the stack of the caller's slot, which the reclaimer with
+    // the slot's index modulo numReclaimers grabs whole, along with its
+    // other stacks, waits a grace period for and invokes in retire order.
+    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp), const size_t bytes = 0)
+    {
+        ThreadState* const ts = my_state();
+        // Inside a read-side critical section neither a grace period nor a
+        // wait for the reclaimers can end, so the object is queued regardless
+        const bool inSection = ts != nullptr && ts->nesting != 0;
+        size_t charged;
+        bool admitted = reclaimBudget.admit(bytes, charged, !inSection);
+        if (!admitted && inSection) {
+            charged = reclaimBudget.charge(bytes);
+            admitted = true;
         }
-        // TODO: Do we need to handle here the waiting callbacks?
+        const int tid = (ts == nullptr) ? -1 : ts->slot->index;
+        std::rcu::callback_executor* const ex = executor.load(std::memory_order_acquire);
+        CallbackNode* const node = new CallbackNode{rhp, cbf, nullptr, ex, (ex == nullptr) ? nullptr : ex->capture(),
+                                                    charged, bytes, count_retired(ts, bytes)};
+        if (!admitted) {
+            // Over the hard limit: reclaim it here, as a reclaimer would
+            synchronize();
+            invoke_node(node, statsRegistry.local(), std::rcu::detail::now_ns());
+            return;
+        }
+        push_callback((ts == nullptr) ? unregisteredCallbacks : ts->slot->callbacks, node);
+        wake_reclaimer(reclaimers[(tid == -1) ? 0 : tid % numReclaimers]);
+    }
+
+    // Reclaimer 0 invokes these right after their grace period, ahead of
+    // any backlog and regardless of the callback budget
+    void retire_urgent(rcu_head *rhp, void (*cbf)(rcu_head *rhp))
+    {
+        push_callback(urgentCallbacks, new CallbackNode{rhp, cbf, nullptr, nullptr, nullptr, 0,
+                                                        0, count_retired(my_state(), 0)});
+        wake_reclaimer(reclaimers[0]);
+    }
+
+    // Limits applied to each reclaimer pass; zero means no limit. What is
+    // left over stays ready and goes after the next batch's grace period
+    // has started, so a mass retire delays it by one budget at most.
+    void set_callback_budget(const long maxItems, const long maxMicroseconds) noexcept
+    {
+        budgetItems.store(maxItems < 0 ? 0 : maxItems, std::memory_order_relaxed);
+        budgetMicroseconds.store(maxMicroseconds < 0 ? 0 : maxMicroseconds, std::memory_order_relaxed);
+    }
+
+    // barrier() then waits for callbacks to be handed over, not run
+    void set_callback_executor(std::rcu::callback_executor* const ex) noexcept
+    {
+        executor.store(ex, std::memory_order_release);
+    }
+
+    // Past the soft limit the reclaimers use expedited grace periods and
+    // ignore the callback budget
+    void set_reclaim_budget(const size_t softBytes, const size_t hardBytes,
+                            const std::rcu::over_hard_limit policy = std::rcu::over_hard_limit::reclaim_inline) noexcept
+    {
+        reclaimBudget.set(softBytes, hardBytes, policy);
     }
+    size_t pending_bytes() const noexcept { return reclaimBudget.pending_bytes(); }
 
-    void retire(rcu_head *rhp, void (*cbf)(rcu_head *rhp))
+    // Everything in domain_stats.  Grace-period latency is counted by the
+    // thread that waited, callbacks by the retiring and the reclaiming
+    // thread, each in a block of its own.  The read side is left alone, so
+    // the longest read section is as seen by grace periods: the longest
+    // that one waited for a single reader, which is a lower bound.
+    std::rcu::domain_stats stats()
     {
-        const int tid = tl_urcu_rv_tid;
-        auto lamb = [&rhp,&cbf,&tid,this]() { synchronize_tid(tid); cbf(rhp); };
-        std::future<void> fut = std::async(std::launch::async, lamb);
-        std::lock_guard<std::mutex> lock(listMutex);
-        futureList.push_back(std::move(fut));
+        std::rcu::domain_stats s;
+        s.measured = std::rcu::domain_stats::grace_periods_measured | std::rcu::domain_stats::callbacks_measured
+                   | std::rcu::domain_stats::read_sections_measured | std::rcu::domain_stats::readers_measured;
+        statsRegistry.collect(s);
+        // Versions are numbered consecutively, so this counts them
+        s.grace_periods = completedVersion.load();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        s.readers = registeredThreads;
+        return s;
     }
 
+    // Called by the stall watchdog with a reader's slot index and OS thread
+    // id, and how long the watchdog has seen it hold up a grace period
+    typedef std::function<void(int slot, long osTid, std::chrono::microseconds stalled)> stall_callback;
+
+    // Starts (or restarts) the stall watchdog, which looks at the slots
+    // every checkEvery (a quarter of the threshold if zero) and reports
+    // readers stalled for longer than threshold to onStall, or prints a
+    // warning if onStall is empty. A reader that no grace period waits for
+    // is not stalled. onStall runs on the watchdog's thread.
+    // Not to be called concurrently with stop_stall_watchdog().
+    void start_stall_watchdog(const std::chrono::milliseconds threshold, stall_callback onStall = nullptr,
+                              std::chrono::milliseconds checkEvery = std::chrono::milliseconds(0))
+    {
+        stop_stall_watchdog();
+        if (checkEvery.count() <= 0) checkEvery = threshold / 4;
+        if (checkEvery.count() <= 0) checkEvery = std::chrono::milliseconds(1);
+        if (!onStall) {
+            onStall = [](const int slot, const long osTid, const std::chrono::microseconds stalled) {
+                std::cout << "Warning: rcu_domain_rv reader in slot " << slot << " (thread " << osTid
+                          << ") has held up a grace period for " << stalled.count() / 1000 << " ms\n";
+            };
+        }
+        watchdog = new StallWatchdog;
+        watchdog->thread = std::thread(&rcu_domain_rv::watchdog_loop, this, threshold, onStall, checkEvery);
+    }
+
+    void stop_stall_watchdog()
+    {
+        if (watchdog == nullptr) return;
+        {
+            std::lock_guard<std::mutex> lock(watchdog->mtx);
+            watchdog->stopping = true;
+            watchdog->wakeup.notify_one();
+        }
+        watchdog->thread.join();
+        delete watchdog;
+        watchdog = nullptr;
+    }
+
+    // Asks every reclaimer for one more pass, and waits until its ready
+    // list has been invoked up to the last callback that pass grabbed
     void barrier() noexcept
     {
-        std::lock_guard<std::mutex> lock(listMutex);
-        for (auto& fut : futureList) fut.wait();
-        futureList.clear();
+        for (int r=0; r < numReclaimers; r++) {
+            Reclaimer& rc = reclaimers[r];
+            std::unique_lock<std::mutex> lock(rc.mtx);
+            if (!has_callbacks(r) && rc.passesStarted == rc.passesCompleted && rc.readyInvoked == rc.readyQueued) continue;
+            // The next pass to start grabs everything retired before now
+            const uint64_t target = rc.passesStarted + 1;
+            rc.passRequested = true;
+            rc.wakeup.notify_one();
+            rc.passDone.wait(lock, [&]{ return rc.passesCompleted >= target; });
+            // ... but may have left some of it on the ready list, which is
+            // invoked in order; urgent callbacks never go there
+            const uint64_t queued = rc.readyQueued;
+            rc.passDone.wait(lock, [&]{ return rc.readyInvoked >= queued; });
+        }
     }
 
     void quiescent_state() noexcept {}
@@ -138,4 +599,542 @@ public:
 
     static constexpr bool register_thread_needed() { return true; }
     static constexpr bool quiescent_state_needed() { return false; }
+
+private:
+    static uint64_t next_domain_id()
+    {
+        static std::atomic<uint64_t> lastId = { 0 };
+        return ++lastId;
+    }
+
+    // Ids of the domains not yet destroyed, so that a thread exiting after
+    // its domain is gone leaves it alone.
+    static std::mutex& live_domains_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::set<uint64_t>& live_domains()
+    {
+        static std::set<uint64_t> ids;
+        return ids;
+    }
+
+    // Waits for every reader but tid to reach waitForVersion, which
+    // reclaimerVersion already has, and records it as completed. Expedited
+    // waits have no deadline.
+    bool wait_for_readers(const int tid, const uint64_t waitForVersion, const bool expedited,
+                          const std::rcu::gp_deadline deadline, int* const blockingSlot) noexcept
+    {
+        const uint64_t startNs = std::rcu::detail::now_ns();
+        std::rcu::detail::stats_block& stats = statsRegistry.local();
+        if (fenceFreeReaders) membarrier();
+        if (expedited) {
+            poll_readers(tid, waitForVersion, startNs, stats);
+        } else {
+            for (int g=0; g < numGroups; g++) {
+                NodeGroup* group = groups[g].load(std::memory_order_acquire);
+                if (group == nullptr || node_quiet(*group, waitForVersion)) continue;
+                bool quiet = true;      // No reader in a section when first looked at
+                const bool done = for_each_slot(*group, [&](ReaderSlot& slot) {
+                    if (slot.version.load() < UNASSIGNED) quiet = false;
+                    // Handle the quiescent_state() case: if it's the same thread, just skip.
+                    // If there is an error in the program and we were called inside a
+                    // block of read_lock()/unlock() then this will cause errors.
+                    if (tid == slot.index) return true;
+                    if (wait_for_reader(slot, waitForVersion, deadline, startNs, stats)) return true;
+                    if (blockingSlot != nullptr) *blockingSlot = slot.index;
+                    return false;
+                });
+                if (!done) return false;
+                if (numaTree && quiet) refresh_summary(*group);
+            }
+        }
+        uint64_t done = completedVersion.load();
+        while (done < waitForVersion && !completedVersion.compare_exchange_weak(done, waitForVersion)) { }
+        stats.gracePeriodLatency.add(std::rcu::detail::now_ns() - startNs);
+        return true;
+    }
+
+    // The expedited wait: rescans the slots from the start until none holds
+    // the grace period up, never yielding or parking, so it ends as soon as
+    // the last reader does rather than one backoff or futex wakeup after
+    // each. Past SPIN_LIMIT rounds, unless the policy is spin, it sleeps
+    // EXPEDITED_SLEEP_US between rounds, in case a reader shares the CPU.
+    void poll_readers(const int tid, const uint64_t waitForVersion, const uint64_t startNs,
+                      std::rcu::detail::stats_block& stats) noexcept
+    {
+        for (int round = 0; ; round++) {
+            bool done = true;
+            for (int g=0; g < numGroups && done; g++) {
+                NodeGroup* group = groups[g].load(std::memory_order_acquire);
+                if (group == nullptr || node_quiet(*group, waitForVersion)) continue;
+                done = for_each_slot(*group, [&](ReaderSlot& slot) {
+                    return tid == slot.index || slot.version.load() >= waitForVersion;
+                });
+            }
+            if (done) {
+                if (round > 0) stats.count_read_section(std::rcu::detail::now_ns() - startNs);
+                return;
+            }
+            if (waitPolicy != wait_policy::spin && round >= SPIN_LIMIT) {
+                const long sleepUs = EXPEDITED_SLEEP_US;
+                std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+            }
+        }
+    }
+
+    // False if the deadline passed first. A reader that held the grace
+    // period up counts as a read section of at least that long.
+    bool wait_for_reader(ReaderSlot& slot, const uint64_t waitForVersion,
+                         const std::rcu::gp_deadline deadline, const uint64_t startNs,
+                         std::rcu::detail::stats_block& stats) noexcept
+    {
+        const bool timed = deadline != std::rcu::gp_deadline::max();
+        if (slot.version.load() >= waitForVersion) return true;
+        for (int i=0; slot.version.load() < waitForVersion; i++) {
+            if (timed && (i >= SPIN_LIMIT || i % 64 == 0) && std::chrono::steady_clock::now() >= deadline) return false;
+            if (waitPolicy == wait_policy::spin || i < SPIN_LIMIT) continue;
+            if (waitPolicy == wait_policy::yield || i < SPIN_LIMIT+YIELD_LIMIT) {
+                std::this_thread::yield();
+                continue;
+            }
+            long timeoutUs = PARK_TIMEOUT_US;
+            if (timed) {
+                const long leftUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now()).count() + 1;
+                if (leftUs < timeoutUs) timeoutUs = leftUs;
+            }
+            slot.waiters.store(1);
+            if (slot.version.load() < waitForVersion) futex_wait(slot.waiters, 1, timeoutUs);
+        }
+        stats.count_read_section(std::rcu::detail::now_ns() - startNs);
+        return true;
+    }
+
+    // In numa_tree mode, whether no reader of the node can be older than
+    // waitForVersion
+    bool node_quiet(NodeGroup& group, const uint64_t waitForVersion) noexcept
+    {
+        if (!numaTree) return false;
+        const uint64_t oldest = group.oldestVersion.load();
+        return oldest >= waitForVersion && oldest != REFRESHING;
+    }
+
+    // Lowers a node summary to version. Only a load while the node has
+    // older readers; a CAS once it was found quiet or is being refreshed.
+    static void lower_summary(std::atomic<uint64_t>& summary, const uint64_t version,
+                              const std::memory_order order) noexcept
+    {
+        uint64_t seen = summary.load(order);
+        while (seen > version && !summary.compare_exchange_weak(seen, version, order, order)) { }
+    }
+
+    // Called when a grace period found no reader in a section on the node:
+    // resets its summary to the oldest version now held there, NOT_READING
+    // if none. A reader that loads the summary after REFRESHING is published
+    // lowers it and so fails the final CAS; one that loaded it earlier had
+    // already published its version, which the second look finds.
+    void refresh_summary(NodeGroup& group) noexcept
+    {
+        uint64_t seen = group.oldestVersion.load();
+        if (seen == NOT_READING || seen == REFRESHING) return;
+        if (!group.oldestVersion.compare_exchange_strong(seen, REFRESHING)) return;
+        if (fenceFreeReaders) membarrier();
+        uint64_t oldest = NOT_READING;
+        for_each_slot(group, [&oldest](ReaderSlot& slot) {
+            const uint64_t version = slot.version.load();
+            if (version < oldest) oldest = version;
+            return true;
+        });
+        uint64_t expected = REFRESHING;
+        group.oldestVersion.compare_exchange_strong(expected, oldest);
+    }
+
+#ifdef __linux__
+    static void futex_wait(std::atomic<int>& word, const int expected, const long timeoutUs) noexcept
+    {
+        struct timespec ts;
+        ts.tv_sec = timeoutUs / 1000000;
+        ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+        syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<int>& word) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+#else
+    // No futex: parking degrades to sleeping for the timeout
+    static void futex_wait(std::atomic<int>&, int, const long timeoutUs) noexcept
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(timeoutUs));
+    }
+
+    static void futex_wake(std::atomic<int>&) noexcept {}
+#endif
+
+#if defined(__linux__) && defined(__NR_membarrier)
+    static bool membarrier_register() noexcept
+    {
+        const long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+        if (cmds < 0 || !(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)) return false;
+        return syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+    }
+
+    static void membarrier() noexcept
+    {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+    }
+#else
+    static bool membarrier_register() noexcept { return false; }
+    static void membarrier() noexcept {}
+#endif
+
+    // cpu -> NUMA node, read once from /sys; empty when unavailable
+    static const std::vector<int>& numa_cpu_to_node()
+    {
+        static const std::vector<int> cpuToNode = read_numa_topology();
+        return cpuToNode;
+    }
+
+    static std::vector<int> read_numa_topology()
+    {
+        std::vector<int> cpuToNode;
+#ifdef __linux__
+        const std::string base = "/sys/devices/system/node";
+        DIR* dir = opendir(base.c_str());
+        if (dir == nullptr) return cpuToNode;
+        while (struct dirent* ent = readdir(dir)) {
+            const std::string name = ent->d_name;
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4) continue;
+            if (name.find_first_not_of("0123456789", 4) != std::string::npos) continue;
+            const int node = std::atoi(name.c_str()+4);
+            std::ifstream in(base + "/" + name + "/cpulist");
+            std::string range;
+            // e.g. "0-3,8-11"
+            while (std::getline(in, range, ',')) {
+                if (range.empty() || range[0] < '0' || range[0] > '9') continue;
+                const int lo = std::atoi(range.c_str());
+                const std::string::size_type dash = range.find('-');
+                const int hi = (dash == std::string::npos) ? lo : std::atoi(range.c_str()+dash+1);
+                if (hi >= (int)cpuToNode.size()) cpuToNode.resize(hi+1, 0);
+                for (int cpu=lo; cpu <= hi; cpu++) cpuToNode[cpu] = node;
+            }
+        }
+        closedir(dir);
+#endif
+        return cpuToNode;
+    }
+
+    static int num_numa_nodes()
+    {
+        int nodes = 1;
+        for (int node : numa_cpu_to_node()) if (node+1 > nodes) nodes = node+1;
+        return nodes;
+    }
+
+    static int current_numa_node()
+    {
+#ifdef __linux__
+        const int cpu = sched_getcpu();
+        const std::vector<int>& cpuToNode = numa_cpu_to_node();
+        if (cpu >= 0 && cpu < (int)cpuToNode.size()) return cpuToNode[cpu];
+#endif
+        return 0;
+    }
+
+    // The calling thread's registration with this domain, or nullptr
+    ThreadState* my_state() const noexcept
+    {
+        ThreadState* ts = tl_cache()[domainId % CACHE_SIZE];
+        if (ts != nullptr && ts->domainId == domainId) return ts;
+        return my_state_slow();
+    }
+
+    // As my_state(), but registers the thread on a miss when autoRegister is set
+    ThreadState* reader_state() noexcept
+    {
+        ThreadState* ts = tl_cache()[domainId % CACHE_SIZE];
+        if (ts != nullptr && ts->domainId == domainId) return ts;
+        ts = my_state_slow();
+        if (ts == nullptr && autoRegister) {
+            register_thread();
+            ts = tl_cache()[domainId % CACHE_SIZE];
+        }
+        return ts;
+    }
+
+    ThreadState* my_state_slow() const noexcept
+    {
+        for (ThreadState* ts : tl_registrations().states) {
+            if (ts->domainId == domainId) {
+                tl_cache()[domainId % CACHE_SIZE] = ts;
+                return ts;
+            }
+        }
+        return nullptr;
+    }
+
+    static void forget(ThreadState* ts) noexcept
+    {
+        std::vector<ThreadState*>& states = tl_registrations().states;
+        for (size_t i=0; i < states.size(); i++) {
+            if (states[i] == ts) {
+                states[i] = states.back();
+                states.pop_back();
+                break;
+            }
+        }
+        if (tl_cache()[ts->domainId % CACHE_SIZE] == ts) tl_cache()[ts->domainId % CACHE_SIZE] = nullptr;
+        delete ts;
+    }
+
+    // Index of the calling thread's slot in this domain, or -1
+    int my_index() const noexcept
+    {
+        const ThreadState* ts = my_state();
+        return (ts == nullptr) ? -1 : ts->slot->index;
+    }
+
+#ifdef __linux__
+    static long os_thread_id() noexcept { return syscall(SYS_gettid); }
+#else
+    static long os_thread_id() noexcept { return -1; }
+#endif
+
+    void watchdog_loop(const std::chrono::milliseconds threshold, const stall_callback onStall,
+                       const std::chrono::milliseconds checkEvery)
+    {
+        // A slot seen at a stale version: since when, and how often reported
+        struct Watch {
+            uint64_t version;
+            std::chrono::steady_clock::time_point since;
+            int reports;
+        };
+        std::unordered_map<int, Watch> watched, seen;
+        StallWatchdog& wd = *watchdog;
+        std::unique_lock<std::mutex> lock(wd.mtx);
+        while (!wd.wakeup.wait_for(lock, checkEvery, [&]{ return wd.stopping; })) {
+            lock.unlock();
+            const uint64_t current = reclaimerVersion.load();
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            seen.clear();
+            for_each_registered_slot([&](ReaderSlot& slot) {
+                // NOT_READING and UNASSIGNED compare above any version
+                const uint64_t version = slot.version.load();
+                if (version >= current) return true;
+                auto it = watched.find(slot.index);
+                Watch w = (it != watched.end() && it->second.version == version) ? it->second
+                                                                                  : Watch{version, now, 0};
+                const std::chrono::steady_clock::duration stalled = now - w.since;
+                if (stalled >= threshold * (w.reports + 1)) {
+                    w.reports++;
+                    onStall(slot.index, slot.osTid.load(std::memory_order_relaxed),
+                            std::chrono::duration_cast<std::chrono::microseconds>(stalled));
+                }
+                seen[slot.index] = w;
+                return true;
+            });
+            watched.swap(seen);
+            lock.lock();
+        }
+    }
+
+    // Calls f(slot) for every registered reader slot
+    template<class F>
+    void for_each_registered_slot(F f)
+    {
+        for (int g=0; g < numGroups; g++) {
+            NodeGroup* group = groups[g].load(std::memory_order_acquire);
+            if (group != nullptr) for_each_slot(*group, f);
+        }
+    }
+
+    // Calls f(slot) for every registered slot of group until it returns
+    // false; false if it did
+    template<class F>
+    static bool for_each_slot(NodeGroup& group, F f)
+    {
+        for (Segment* seg = group.firstSegment; seg != nullptr; seg = seg->next.load(std::memory_order_acquire)) {
+            for (int w=0; w < seg->words; w++) {
+                for (uint64_t bits = seg->occupied[w].load(); bits != 0; bits &= bits-1) {
+                    if (!f(seg->slots[w*64 + __builtin_ctzll(bits)])) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Calls f(stack) for every callback stack drained by reclaimer r
+    template<class F>
+    void for_each_stack(const int r, F f)
+    {
+        if (r == 0) f(unregisteredCallbacks);
+        for (int g=0; g < numGroups; g++) {
+            NodeGroup* group = groups[g].load(std::memory_order_acquire);
+            if (group == nullptr) continue;
+            for (Segment* seg = group->firstSegment; seg != nullptr; seg = seg->next.load(std::memory_order_acquire)) {
+                for (int i=0; i < seg->size; i++) {
+                    if (seg->slots[i].index % numReclaimers == r) f(seg->slots[i].callbacks);
+                }
+            }
+        }
+    }
+
+    // Counts a callback against the retiring thread; returns its timestamp
+    uint64_t count_retired(ThreadState* const ts, const size_t bytes)
+    {
+        std::rcu::detail::stats_block& b = (ts == nullptr) ? statsRegistry.local() : *ts->stats;
+        std::rcu::detail::bump(b.retired);
+        std::rcu::detail::bump(b.retiredBytes, bytes);
+        return std::rcu::detail::now_ns();
+    }
+
+    static void push_callback(std::atomic<CallbackNode*>& stack, CallbackNode* node) noexcept
+    {
+        node->next = stack.load();
+        while (!stack.compare_exchange_weak(node->next, node)) { }
+    }
+
+    // Only pay for the mutex when the reclaimer has gone to sleep
+    static void wake_reclaimer(Reclaimer& rc)
+    {
+        if (rc.sleeping.load()) {
+            std::lock_guard<std::mutex> lock(rc.mtx);
+            rc.wakeup.notify_one();
+        }
+    }
+
+    // Detaches a stack and returns it oldest-first, setting *count
+    static CallbackNode* take_fifo(std::atomic<CallbackNode*>& stack, uint64_t& count) noexcept
+    {
+        CallbackNode* node = stack.exchange(nullptr);
+        CallbackNode* fifo = nullptr;
+        while (node != nullptr) {
+            CallbackNode* next = node->next;
+            node->next = fifo;
+            fifo = node;
+            node = next;
+            count++;
+        }
+        return fifo;
+    }
+
+    // Invokes a callback whose grace period is over, and frees its node
+    void invoke_node(CallbackNode* const node, std::rcu::detail::stats_block& stats, const uint64_t nowNs) noexcept
+    {
+        node->invoke();
+        reclaimBudget.credit(node->charged);
+        stats.count_invoked(node->bytes, node->retiredNs, nowNs);
+        delete node;
+    }
+
+    // Invokes callbacks off the ready list until the budget runs out, if
+    // not past the soft limit on pending bytes
+    uint64_t invoke_ready(Reclaimer& rc) noexcept
+    {
+        const bool drain = reclaimBudget.over_soft();
+        const long maxItems = drain ? 0 : budgetItems.load(std::memory_order_relaxed);
+        const long maxMicroseconds = drain ? 0 : budgetMicroseconds.load(std::memory_order_relaxed);
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::rcu::detail::stats_block& stats = statsRegistry.local();
+        uint64_t nowNs = 0;
+        uint64_t n = 0;
+        while (rc.ready != nullptr) {
+            if (maxItems != 0 && n >= (uint64_t)maxItems) break;
+            if (maxMicroseconds != 0 && n != 0 &&
+                std::chrono::steady_clock::now() - start >= std::chrono::microseconds(maxMicroseconds)) break;
+            CallbackNode* node = rc.ready;
+            rc.ready = node->next;
+            if (rc.ready == nullptr) rc.readyTail = &rc.ready;
+            // The clock is read every 64 callbacks, which a batch takes microseconds for
+            if (n % 64 == 0) nowNs = std::rcu::detail::now_ns();
+            invoke_node(node, stats, nowNs);
+            n++;
+        }
+        return n;
+    }
+
+    bool has_callbacks(const int r) noexcept
+    {
+        if (r == 0 && urgentCallbacks.load() != nullptr) return true;
+        bool found = false;
+        for_each_stack(r, [&](std::atomic<CallbackNode*>& stack) {
+            if (stack.load() != nullptr) found = true;
+        });
+        return found;
+    }
+
+    void reclaimer_loop(const int r)
+    {
+        Reclaimer& rc = reclaimers[r];
+        std::unique_lock<std::mutex> lock(rc.mtx);
+        while (true) {
+            // retire() checks 'sleeping' after pushing, so either it sees
+            // the flag and notifies, or we see its callback here.
+            rc.sleeping.store(true);
+            rc.wakeup.wait(lock, [&]{
+                return stopping || rc.passRequested || rc.ready != nullptr || has_callbacks(r);
+            });
+            rc.sleeping.store(false);
+            if (stopping && rc.ready == nullptr && !has_callbacks(r)) break;
+            rc.passRequested = false;
+            rc.passesStarted++;
+            lock.unlock();
+
+            // Grab every stack, oldest callback first.
+            uint64_t urgentGrabbed = 0;
+            uint64_t grabbed = 0;
+            CallbackNode* urgent = (r == 0) ? take_fifo(urgentCallbacks, urgentGrabbed) : nullptr;
+            CallbackNode* batch = nullptr;
+            CallbackNode** tail = &batch;
+            for_each_stack(r, [&](std::atomic<CallbackNode*>& stack) {
+                *tail = take_fifo(stack, grabbed);
+                while (*tail != nullptr) tail = &(*tail)->next;
+            });
+            const std::rcu::gp_state cookie = get_state();
+            if (grabbed + urgentGrabbed != 0) {
+                // One grace period covers the whole batch, and none at all is
+                // needed if some updater's synchronize() has already done the
+                // job. This thread is not a registered reader, so
+                // synchronize_tid() skips no slot.
+                if (!poll_state(cookie)) {
+                    if (reclaimBudget.over_soft()) synchronize_expedited();
+                    else synchronize();
+                }
+            }
+            while (urgent != nullptr) {
+                CallbackNode* next = urgent->next;
+                invoke_node(urgent, statsRegistry.local(), std::rcu::detail::now_ns());
+                urgent = next;
+            }
+            if (batch != nullptr) {
+                *rc.readyTail = batch;
+                rc.readyTail = tail;
+            }
+            const uint64_t invoked = invoke_ready(rc);
+
+            lock.lock();
+            rc.readyQueued += grabbed;
+            rc.readyInvoked += invoked;
+            rc.passesCompleted++;
+            rc.passDone.notify_all();
+        }
+    }
 };
+
+
+inline rcu_domain_rv::Registrations::~Registrations()
+{
+    std::lock_guard<std::mutex> lock(live_domains_mutex());
+    while (!states.empty()) {
+        ThreadState* ts = states.back();
+        if (live_domains().count(ts->domainId) != 0) {
+            ts->domain->unregister_thread();    // Removes ts from states
+        } else {
+            forget(ts);
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include "rcu_counter_domain.hpp"
+
+/**
+ * Sleepable RCU in the style of the Linux kernel's SRCU, using only the C++
+ * memory model and atomics.
+ *
+ * Readers are not tied to a thread: read_lock() returns a token (0 or 1,
+ * the index in use when the section started) and read_unlock(token) may be
+ * called from any thread, for instance after a coroutine has been resumed
+ * elsewhere. Sections may block for as long as they like; only grace
+ * periods of this domain wait for them. No registration is needed.
+ *
+ * Every possible CPU has a lock and an unlock counter for each of the two indexes.
+ * read_lock() bumps the lock counter of the current index on the CPU it
+ * runs on, then issues a full fence; read_unlock() issues a full fence and
+ * then bumps the unlock counter of the token's index on whatever CPU it runs
+ * on. The counters are atomic because several threads share a CPU and a
+ * thread may migrate between reading its CPU number and the increment, but
+ * the increments are relaxed and mostly CPU-local. An index has no readers
+ * left when the sum of its unlock counters, read first, equals the sum of
+ * its lock counters, read after a fence.
+ *
+ * synchronize() takes the domain's mutex, waits out stragglers on the
+ * inactive index (readers that read the index just before the previous
+ * flip), flips the index, and waits for the readers of the old index. Each
+ * wait checks the counters in a loop, then sleeps between checks with a
+ * doubling delay; synchronize_expedited() keeps the first delay.
+ * try_synchronize() and synchronize_until() run the same steps but give up
+ * at the deadline, leaving the grace period's number, old index and phase
+ * in the domain for whichever call comes next to resume.
+ *
+ * retire() queues the callback for the domain's callback thread, which
+ * waits for one grace period per batch. set_callback_budget(),
+ * retire_urgent() and set_callback_executor() behave as in rcu_domain_rv:
+ * leftovers beyond the budget run after the next batch has been grabbed,
+ * urgent callbacks run first, and an executor gets every other callback.
+ * So does set_reclaim_budget(): past the soft limit the callback thread
+ * uses expedited grace periods and ignores the callback budget.
+ *
+ * Read-side sections through rcu_domain_wrapper (or rcu_guard and
+ * basic_rcu_reader, which keep the token themselves) are supported as for
+ * any other domain; the wrapper keeps the tokens on a per-thread stack.
+ *
+ * Everything but the read side is std::rcu::detail::counter_domain, shared
+ * with rcu_domain_rseq.
+ */
+class rcu_domain_srcu : public std::rcu::detail::counter_domain {
+public:
+    rcu_domain_srcu() : counter_domain(false) {}
+
+    token read_lock() noexcept
+    {
+        const token idx = index.load(std::memory_order_relaxed) & 1;
+        counters[my_cpu()].locks[idx].fetch_add(1, std::memory_order_relaxed);
+        // Orders the increment before the critical section; pairs with the
+        // fence between the two sums in readers_gone().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return idx;
+    }
+
+    void read_unlock(const token idx) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        counters[my_cpu()].unlocks[idx].fetch_add(1, std::memory_order_relaxed);
+    }
+};
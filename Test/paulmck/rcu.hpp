@@ -2,29 +2,54 @@
 
 #include <cstddef>
 #include <memory>
+#include <typeinfo>
 #include <mutex>
 #include <utility>
+#include <type_traits>
+#include "rcu_domain.hpp"
+#include "urcu-default.hpp"
+#include "rcu_trace.hpp"
 
 // Derived-type approach.  All RCU-protected data structures using this
 // approach must derive from std::rcu_obj_base, which in turn derives
 // from std::rcu_head.  No idea what happens in case of multiple inheritance.
+//
+// retire() and rcu_retire() report the size of what they retire, sizeof(T)
+// unless told otherwise, against the domain's set_reclaim_budget().
 
 namespace std {
     template<typename T, typename D = default_delete<T>, bool E = is_empty<D>::value>
     class rcu_obj_base: private rcu_head {
         D deleter;
+
+        static void trampoline(rcu_head *rhp)
+        {
+            auto rhdp = static_cast<rcu_obj_base *>(rhp);
+            auto obj = static_cast<T *>(rhdp);
+            RCU_PROBE2(callback, obj, typeid(D).name());
+            rhdp->deleter(obj);
+        }
     public:
-        void retire(D d = {}) noexcept
+        // The rcu_head that retire() hands the domain, for domains that
+        // need to match it against the object, such as rcu_domain_hp.
+        friend rcu_head *rcu_head_of(rcu_obj_base *p) noexcept { return p; }
+
+        void retire(D d = {}, size_t bytes = sizeof(T)) noexcept
         {
             deleter = std::move(d);
-            ::call_rcu(
-                static_cast<rcu_head *>(this),
-                [](rcu_head *rhp) {
-                    auto rhdp = static_cast<rcu_obj_base *>(rhp);
-                    auto obj = static_cast<T *>(rhdp);
-                    rhdp->deleter(obj);
-                }
-            );
+            rcu_global_domain rd;
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rd.retire(static_cast<rcu_head *>(this), trampoline, bytes);
+        }
+
+        // Retire via a domain chosen at compile time, calling it directly.
+        template<typename Domain,
+                 typename = typename enable_if<rcu::is_rcu_domain<Domain>::value>::type>
+        void retire(Domain& rd, D d = {}, size_t bytes = sizeof(T))
+        {
+            deleter = std::move(d);
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rcu::detail::retire_sized(rd, static_cast<rcu_head *>(this), trampoline, bytes, 0);
         }
     };
 
@@ -33,91 +58,135 @@ namespace std {
 
     template<typename T, typename D>
     class rcu_obj_base<T,D,true>: private rcu_head {
+        static void trampoline(rcu_head *rhp)
+        {
+            auto rhdp = static_cast<rcu_obj_base *>(rhp);
+            auto obj = static_cast<T *>(rhdp);
+            RCU_PROBE2(callback, obj, typeid(D).name());
+            D()(obj);
+        }
     public:
-        void retire(D = {}) noexcept
+        // As in the primary template
+        friend rcu_head *rcu_head_of(rcu_obj_base *p) noexcept { return p; }
+
+        void retire(D = {}, size_t bytes = sizeof(T)) noexcept
         {
-            ::call_rcu(
-                static_cast<rcu_head *>(this),
-                [](rcu_head *rhp) {
-                    auto rhdp = static_cast<rcu_obj_base *>(rhp);
-                    auto obj = static_cast<T *>(rhdp);
-                    D()(obj);
-                }
-            );
+            rcu_global_domain rd;
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rd.retire(static_cast<rcu_head *>(this), trampoline, bytes);
+        }
+
+        template<typename Domain,
+                 typename = typename enable_if<rcu::is_rcu_domain<Domain>::value>::type>
+        void retire(Domain& rd, D = {}, size_t bytes = sizeof(T))
+        {
+            RCU_PROBE4(retire, static_cast<T *>(this), typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes);
+            rcu::detail::retire_sized(rd, static_cast<rcu_head *>(this), trampoline, bytes, 0);
         }
     };
 
-    // RAII for RCU readers
-    class rcu_reader {
+    // RAII for RCU readers.  With a concrete Domain the read side inlines
+    // to that domain's primitives; basic_rcu_reader<rcu::rcu_domain_base>
+    // is the runtime-selected alternative, at the cost of virtual calls.
+    template<typename Domain>
+    class basic_rcu_reader {
+        static_assert(rcu::is_rcu_domain<Domain>::value,
+                      "basic_rcu_reader needs a type satisfying the RcuDomain concept");
     public:
-        rcu_reader() noexcept
+        // These two are for process-wide domains, such as the liburcu
+        // flavors (see default_domain); anything else fails to compile
+        basic_rcu_reader() noexcept
+            : rd(&rcu::default_domain<Domain>::instance)
+        {
+            token = rcu::read_lock(*rd);
+            active = true;
+        }
+        basic_rcu_reader(std::defer_lock_t) noexcept
+            : rd(&rcu::default_domain<Domain>::instance)
         {
-            rcu_read_lock();
+            active = false;
+        }
+        explicit basic_rcu_reader(Domain& d) noexcept
+            : rd(&d)
+        {
+            token = rcu::read_lock(*rd);
             active = true;
         }
-        rcu_reader(std::defer_lock_t) noexcept
+        basic_rcu_reader(Domain& d, std::defer_lock_t) noexcept
+            : rd(&d)
         {
             active = false;
         }
-        rcu_reader(const rcu_reader &) = delete;
-        rcu_reader(rcu_reader&& other) noexcept
+        basic_rcu_reader(const basic_rcu_reader &) = delete;
+        basic_rcu_reader(basic_rcu_reader&& other) noexcept
         {
+            rd = other.rd;
+            token = other.token;
             active = other.active;
             other.active = false;
         }
-        rcu_reader& operator=(const rcu_reader&) = delete;
-        rcu_reader& operator=(rcu_reader&& other) noexcept
+        basic_rcu_reader& operator=(const basic_rcu_reader&) = delete;
+        basic_rcu_reader& operator=(basic_rcu_reader&& other) noexcept
         {
             if (active) {
-                rcu_read_unlock();
+                rcu::read_unlock(*rd, token);
             }
+            rd = other.rd;
+            token = other.token;
             active = other.active;
             other.active = false;
             return *this;
         }
 
-        ~rcu_reader() noexcept
+        ~basic_rcu_reader() noexcept
         {
             if (active) {
-                rcu_read_unlock();
+                rcu::read_unlock(*rd, token);
             }
         }
 
-        void swap(rcu_reader& other) noexcept
+        void swap(basic_rcu_reader& other) noexcept
         {
+            std::swap(rd, other.rd);
+            std::swap(token, other.token);
             std::swap(active, other.active);
         }
 
         void lock() noexcept
         {
-            rcu_read_lock();
+            token = rcu::read_lock(*rd);
             active = true;
         }
 
         void unlock() noexcept
         {
-            rcu_read_unlock();
+            rcu::read_unlock(*rd, token);
             active = false;
         }
 
     private:
+        Domain *rd;
+        rcu::read_token<Domain> token;   // Empty unless read_lock() returns one
         bool active;
     };
 
-    void swap(rcu_reader& a, rcu_reader& b) noexcept
+    template<typename Domain>
+    void swap(basic_rcu_reader<Domain>& a, basic_rcu_reader<Domain>& b) noexcept
     {
         a.swap(b);
     }
 
+    typedef basic_rcu_reader<rcu_global_domain> rcu_reader;
+
     // Free functions for RCU updaters
-    void synchronize_rcu() noexcept
+    inline void synchronize_rcu() noexcept
     {
-	::synchronize_rcu();
+	rcu_global_domain().synchronize();
     }
 
-    void rcu_barrier() noexcept
+    inline void rcu_barrier() noexcept
     {
-	::rcu_barrier();
+	rcu_global_domain().barrier();
     }
 
     namespace details {
@@ -134,18 +203,22 @@ namespace std {
     }
 
     template<typename T, typename D = default_delete<T>>
-    void rcu_retire(T *p, D d = {})
+    void rcu_retire(T *p, D d = {}, size_t bytes = sizeof(T))
     {
 	auto robnp = new details::rcu_obj_base_ni<T, D>(p, d);
+	rcu_global_domain rd;
 
-	::call_rcu(
+	RCU_PROBE4(retire, p, typeid(D).name(), rcu::detail::probe_sequence(rd, 0), bytes + sizeof(*robnp));
+	rd.retire(
 	    static_cast<rcu_head *>(robnp),
 	    [](rcu_head *rhp) {
 		auto robnp2 = static_cast<details::rcu_obj_base_ni<T, D> *>(rhp);
 
+		RCU_PROBE2(callback, robnp2->p, typeid(D).name());
 		robnp2->d(robnp2->p);
 		delete robnp2;
-	    });
+	    },
+	    bytes + sizeof(*robnp));
     }
 
 } // namespace std
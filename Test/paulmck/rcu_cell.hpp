@@ -3,7 +3,9 @@
 #include <cstddef>
 #include <memory>
 #include <type_traits>
-#include "rcu_obj_base.hpp"
+#include <typeinfo>
+#include "rcu.hpp"
+#include "rcu_trace.hpp"
 
 namespace std {
 namespace rcu {
@@ -67,6 +69,9 @@ class cell {
     std::shared_ptr<control_block> cb;
     cb_allocator a;
 
+    // Counts the value along with its control block against the reclaim budget
+    static void retire_control_block(control_block *p) { p->retire({}, sizeof(control_block) + sizeof(T)); }
+
     static_assert(std::is_same<
         typename std::allocator_traits<cb_allocator>::pointer,
         control_block *
@@ -83,11 +88,12 @@ class cell {
     explicit cell(std::unique_ptr<T> u, Alloc alloc = Alloc()) : a(std::move(alloc)) {
         control_block *new_cb = std::allocator_traits<cb_allocator>::allocate(a, 1);
         std::allocator_traits<cb_allocator>::construct(a, new_cb, u.release(), a);
-        cb = std::shared_ptr<control_block>(new_cb, [](control_block *p) { p->retire(); });
+        cb = std::shared_ptr<control_block>(new_cb, retire_control_block);
     }
 
     void update(nullptr_t) {
         // "Update" the cell to become "empty", which means to abandon (retire) it.
+        RCU_PROBE3(cell_update, this, static_cast<T *>(nullptr), typeid(T).name());
         std::atomic_store(&cb, decltype(cb)(nullptr));
     }
 
@@ -99,7 +105,8 @@ class cell {
         } else {
             control_block *new_cb = std::allocator_traits<cb_allocator>::allocate(a, 1);
             std::allocator_traits<cb_allocator>::construct(a, new_cb, u.release(), a);
-            std::shared_ptr<control_block> sptr(new_cb, [](control_block *p) { p->retire(); });
+            std::shared_ptr<control_block> sptr(new_cb, retire_control_block);
+            RCU_PROBE3(cell_update, this, new_cb->t, typeid(T).name());
             std::atomic_store(&cb, sptr);
         }
     }
@@ -4,6 +4,7 @@
 #define RCU_SIGNAL
 #include <urcu.h>
 #include <rcu.hpp>
+#include "urcu-signal.hpp"
 
 std::unique_lock<std::rcu_reader> blork;
 
@@ -52,6 +53,14 @@ int main(int argc, char **argv)
 	std::cout << "Back from end_rcu_read()\n";
     }
 
+    rcu_domain_signal rs;
+    std::rcu::rcu_domain_wrapper<rcu_domain_signal> rsw(rs);
+    {
+	std::basic_rcu_reader<rcu_domain_signal> rdr1(rs);
+	std::basic_rcu_reader<rcu_domain_signal> rdr2;
+	std::basic_rcu_reader<std::rcu::rcu_domain_base> rdr3(rsw);
+    }
+
     // First with a normal function.
     fp->retire();
     std::rcu_barrier(); // Drain all callbacks on general principles
@@ -59,7 +68,7 @@ int main(int argc, char **argv)
     // Next with a rcu_domain
     fp = new struct foo;
     fp->a = 43;
-    fp->retire();
+    fp->retire(rs);
     std::rcu_barrier();
 
     // Next with bare retire().
@@ -1,17 +1,25 @@
 #pragma once
 
+#include "rcu_domain.hpp"
+
+// Domain is a template parameter, so that with a concrete domain the read
+// side inlines to that domain's primitives.  Use rcu_domain_base for a
+// domain that is only chosen at run time.
 template<class Domain>
 class rcu_guard {
+    static_assert(std::rcu::is_rcu_domain<Domain>::value,
+                  "rcu_guard needs a type satisfying the RcuDomain concept");
 public:
+    // For process-wide domains, such as the liburcu flavors (see
+    // default_domain); anything else fails to compile
     rcu_guard() noexcept
+        : rd(std::rcu::default_domain<Domain>::instance),
+          token(std::rcu::read_lock(rd))
     {
-        this->rd = nullptr;
-        ::rcu_read_lock();
     }
 
-    explicit rcu_guard(Domain& d) : rd(&d)
+    explicit rcu_guard(Domain& d) : rd(d), token(std::rcu::read_lock(rd))
     {
-        rd->read_lock();
     }
 
     rcu_guard(const rcu_guard&) = delete;
@@ -19,12 +27,10 @@ public:
 
     ~rcu_guard() noexcept
     {
-        if (this->rd)
-            this->rd->read_unlock();
-        else
-            ::rcu_read_unlock();
+        std::rcu::read_unlock(rd, token);
     }
 
 private:
-    Domain *rd;
+    Domain& rd;
+    std::rcu::read_token<Domain> token;  // Empty unless read_lock() returns one
 };